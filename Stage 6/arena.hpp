@@ -0,0 +1,153 @@
+// File: arena.hpp
+// Description: Bump-pointer arena for per-request temporaries (reset once per event-loop
+//              iteration) and a free-list pool of fixed-size connection buffers.
+
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <vector>
+
+class Arena {
+public:
+    explicit Arena(size_t block_size = 64 * 1024) : block_size_(block_size) {}
+    ~Arena() {
+        for (Block& b : blocks_) std::free(b.data);
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* alloc(size_t size, size_t align = alignof(std::max_align_t)) {
+        if (current_ < blocks_.size()) {
+            size_t offset = (used_ + align - 1) & ~(align - 1);
+            if (offset + size <= blocks_[current_].size) {
+                used_ = offset + size;
+                return blocks_[current_].data + offset;
+            }
+        }
+        return alloc_slow(size, align);
+    }
+
+    // Uninitialised storage; only for trivially destructible types, nothing is destroyed on reset().
+    template <typename T>
+    T* alloc_array(size_t n) {
+        return static_cast<T*>(alloc(sizeof(T) * n, alignof(T)));
+    }
+
+    std::string_view copy(const char* s, size_t len) {
+        char* p = static_cast<char*>(alloc(len + 1, 1));
+        std::memcpy(p, s, len);
+        p[len] = '\0';
+        return std::string_view(p, len);
+    }
+
+    // printf into the arena; the view is NUL-terminated and valid until reset().
+    __attribute__((format(printf, 2, 3)))
+    std::string_view format(const char* fmt, ...) {
+        va_list args, again;
+        va_start(args, fmt);
+        va_copy(again, args);
+        int len = std::vsnprintf(nullptr, 0, fmt, args);
+        va_end(args);
+        if (len < 0) {
+            va_end(again);
+            return std::string_view();
+        }
+        char* p = static_cast<char*>(alloc((size_t)len + 1, 1));
+        std::vsnprintf(p, (size_t)len + 1, fmt, again);
+        va_end(again);
+        return std::string_view(p, (size_t)len);
+    }
+
+    // Drops everything allocated since the last reset; blocks are kept for reuse.
+    void reset() {
+        current_ = 0;
+        used_ = 0;
+    }
+
+    size_t capacity() const {
+        size_t total = 0;
+        for (const Block& b : blocks_) total += b.size;
+        return total;
+    }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    void* alloc_slow(size_t size, size_t align) {
+        // Move on to the next retained block that fits before asking the heap for more.
+        while (++current_ < blocks_.size()) {
+            if (size + align <= blocks_[current_].size) break;
+        }
+        if (current_ >= blocks_.size()) {
+            size_t bytes = size + align > block_size_ ? size + align : block_size_;
+            char* data = static_cast<char*>(std::malloc(bytes));
+            if (!data) throw std::bad_alloc();
+            blocks_.push_back({data, bytes});
+            current_ = blocks_.size() - 1;
+        }
+        used_ = 0;
+        return alloc(size, align);
+    }
+
+    size_t block_size_;
+    std::vector<Block> blocks_;
+    size_t current_ = 0;
+    size_t used_ = 0;
+};
+
+// Fixed-size buffers carved out of slabs; released buffers go on an intrusive free list.
+class BufferPool {
+public:
+    explicit BufferPool(size_t buffer_size, size_t buffers_per_slab = 64)
+        : buffer_size_(buffer_size < sizeof(void*) ? sizeof(void*) : buffer_size),
+          per_slab_(buffers_per_slab) {}
+    ~BufferPool() {
+        for (char* slab : slabs_) std::free(slab);
+    }
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    char* acquire() {
+        if (!free_list_) grow();
+        char* buf = free_list_;
+        std::memcpy(&free_list_, buf, sizeof(char*));
+        ++in_use_;
+        return buf;
+    }
+
+    void release(char* buf) {
+        std::memcpy(buf, &free_list_, sizeof(char*));
+        free_list_ = buf;
+        --in_use_;
+    }
+
+    size_t buffer_size() const { return buffer_size_; }
+    size_t in_use() const { return in_use_; }
+
+private:
+    void grow() {
+        char* slab = static_cast<char*>(std::malloc(buffer_size_ * per_slab_));
+        if (!slab) throw std::bad_alloc();
+        slabs_.push_back(slab);
+        for (size_t i = per_slab_; i-- > 0;) {
+            char* buf = slab + i * buffer_size_;
+            std::memcpy(buf, &free_list_, sizeof(char*));
+            free_list_ = buf;
+        }
+    }
+
+    size_t buffer_size_;
+    size_t per_slab_;
+    std::vector<char*> slabs_;
+    char* free_list_ = nullptr;
+    size_t in_use_ = 0;
+};
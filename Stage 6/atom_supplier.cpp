@@ -4,30 +4,95 @@
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
+#include "shm_ring.hpp"
+
+using Clock = std::chrono::steady_clock;
 
 void print_usage(const char* prog) {
     std::cerr << "Usage:\n";
-    std::cerr << "  " << prog << " <HOSTNAME> <PORT>       # TCP mode\n";
-    std::cerr << "  " << prog << " -f <UDS_SOCKET_PATH>    # UDS stream mode\n";
+    std::cerr << "  " << prog << " [-a] <HOSTNAME> <PORT>       # TCP mode\n";
+    std::cerr << "  " << prog << " [-a] -f <UDS_SOCKET_PATH>    # UDS stream mode\n";
+    std::cerr << "  " << prog << " [-a] -q <SEQPACKET_PATH>     # UDS seqpacket mode, one message per line\n";
+    std::cerr << "  " << prog << " [-a] -m <SHM_NAME> [--shm-busy-poll]    # shared-memory mode (drinks_bar -m)\n";
+    std::cerr << "  " << prog << " --bulk <FILE> [--conns N] (<HOSTNAME> <PORT> | -f <UDS_SOCKET_PATH>)\n";
+    std::cerr << "  -a: ask the warehouse for cumulative acks and report ADD latency\n";
+    std::cerr << "  --bulk: replay an ADD file over N parallel connections and report ADDs/s\n";
 }
 
-int main(int argc, char* argv[]) {
+// Ack mode bookkeeping: the warehouse answers "ACK <seq>" once the first seq lines are applied.
+struct AckTracker {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<Clock::time_point> sent_at;  // send times of the lines not acked yet
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    double total_ms = 0;
+    double max_ms = 0;
+};
+
+void read_acks(int sockfd, AckTracker& acks) {
+    char buffer[1024];
+    std::string pending;
+    ssize_t len;
+    while ((len = recv(sockfd, buffer, sizeof(buffer), 0)) > 0) {
+        pending.append(buffer, len);
+        size_t nl;
+        while ((nl = pending.find('\n')) != std::string::npos) {
+            bool is_ack = nl >= 4 && pending.compare(0, 4, "ACK ") == 0;
+            uint64_t seq = is_ack ? std::strtoull(pending.c_str() + 4, nullptr, 10) : 0;
+            pending.erase(0, nl + 1);
+            if (!is_ack) continue;
+
+            std::lock_guard<std::mutex> lock(acks.mu);
+            auto now = Clock::now();
+            double last_ms = 0;
+            while (acks.acked < seq && !acks.sent_at.empty()) {
+                last_ms = std::chrono::duration<double, std::milli>(now - acks.sent_at.front()).count();
+                acks.total_ms += last_ms;
+                if (last_ms > acks.max_ms) acks.max_ms = last_ms;
+                acks.sent_at.pop_front();
+                ++acks.acked;
+            }
+            std::cout << "[ACK] " << seq << " (" << last_ms << " ms)" << std::endl;
+            acks.cv.notify_all();
+        }
+    }
+    std::lock_guard<std::mutex> lock(acks.mu);
+    acks.cv.notify_all();
+}
+
+// Connects over UDS (uds_type: SOCK_STREAM or SOCK_SEQPACKET) when uds_path is set, TCP
+// otherwise. Returns -1 on failure.
+int connect_warehouse(const std::string& uds_path, const char* hostname, int port, int uds_type = SOCK_STREAM) {
     int sockfd = -1;
 
     // UDS mode: ./atom_supplier -f /tmp/socket_path
-    if (argc == 3 && std::string(argv[1]) == "-f") {
-        std::string uds_path = argv[2];
-
-        sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!uds_path.empty()) {
+        sockfd = socket(AF_UNIX, uds_type, 0);
         if (sockfd < 0) {
             perror("socket (UDS)");
-            return 1;
+            return -1;
         }
 
         sockaddr_un server_addr{};
@@ -37,62 +102,337 @@ int main(int argc, char* argv[]) {
         if (connect(sockfd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
             perror("connect (UDS)");
             close(sockfd);
-            return 1;
+            return -1;
         }
-
-        std::cout << "Connected to warehouse via UDS: " << uds_path << std::endl;
+        return sockfd;
     }
 
     // TCP mode: ./atom_supplier <hostname> <port>
-    else if (argc == 3) {
-        const char* hostname = argv[1];
-        int port = 0;
+    struct hostent* server = gethostbyname(hostname);
+    if (!server) {
+        std::cerr << "Error: No such host.\n";
+        return -1;
+    }
 
-        try {
-            port = std::stoi(argv[2]);
-        } catch (...) {
-            std::cerr << "Invalid port number.\n";
-            print_usage(argv[0]);
-            return 1;
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("socket (TCP)");
+        return -1;
+    }
+
+    sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    std::memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+
+    if (connect(sockfd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect (TCP)");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// === Shared-memory mode ===
+
+// Every line is answered ("ACK <n>" for ADDs); replies are taken as they come, and with -a
+// each one reports the line's latency.
+int run_shm(const std::string& name, bool ack_mode, bool busy_poll) {
+    ShmClient shm;
+    if (!shm.attach(name)) return 1;
+    std::cout << "Connected to warehouse via shared memory: " << name << " (channel " << shm.channel_index() << ")"
+              << std::endl;
+
+    std::deque<Clock::time_point> sent_at;
+    uint64_t sent = 0, acked = 0;
+    double total_ms = 0, max_ms = 0;
+    auto take_reply = [&](int timeout_ms) {
+        std::string reply;
+        if (!shm.receive(reply, busy_poll, timeout_ms)) return false;
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - sent_at.front()).count();
+        sent_at.pop_front();
+        if (reply.compare(0, 4, "ACK ") != 0) {
+            std::cout << "Server response: " << reply << std::endl;
+            return true;
         }
+        ++acked;
+        total_ms += ms;
+        if (ms > max_ms) max_ms = ms;
+        if (ack_mode) std::cout << "[ACK] " << reply.substr(4) << " (" << ms << " ms)" << std::endl;
+        return true;
+    };
 
-        struct hostent* server = gethostbyname(hostname);
-        if (!server) {
-            std::cerr << "Error: No such host.\n";
-            return 1;
+    std::cout << "Enter commands (e.g., ADD HYDROGEN 50). Ctrl+D to quit.\n";
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.empty()) continue;
+        while (shm.outstanding() == SHM_RING_SLOTS && take_reply(1000)) {}
+        sent_at.push_back(Clock::now());
+        if (!shm.send(line)) {
+            sent_at.pop_back();
+            if (errno == EMSGSIZE) {
+                std::cerr << "shm: line longer than " << SHM_LINE_BYTES << " bytes, not sent\n";
+                continue;
+            }
+            std::cerr << "shm: request ring full\n";
+            break;
         }
+        ++sent;
+        while (shm.outstanding() > 0 && take_reply(0)) {}
+    }
+    while (shm.outstanding() > 0 && take_reply(2000)) {}
 
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockfd < 0) {
-            perror("socket (TCP)");
-            return 1;
+    if (ack_mode) {
+        std::cout << "Acked " << acked << "/" << sent << " lines";
+        if (acked > 0) std::cout << ", avg " << total_ms / acked << " ms, max " << max_ms << " ms";
+        std::cout << std::endl;
+    }
+    std::cout << "Disconnected.\n";
+    return 0;
+}
+
+// === Bulk mode ===
+
+struct BulkResult {
+    uint64_t lines = 0;
+    uint64_t acked = 0;
+    bool ok = true;
+};
+
+// Reads whatever acks are waiting and raises acked to the highest one seen. Returns false
+// once the connection is closed or failed, or a blocking read timed out.
+bool drain_acks(int sockfd, std::string& pending, uint64_t& acked, int flags) {
+    char buffer[4096];
+    ssize_t len = recv(sockfd, buffer, sizeof(buffer), flags);
+    if (len < 0 && (flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    if (len <= 0) return false;
+    pending.append(buffer, len);
+    size_t nl;
+    while ((nl = pending.find('\n')) != std::string::npos) {
+        if (nl >= 4 && pending.compare(0, 4, "ACK ") == 0) acked = std::strtoull(pending.c_str() + 4, nullptr, 10);
+        pending.erase(0, nl + 1);
+    }
+    return true;
+}
+
+// The bar's ack sequence counts ADD lines, not control lines such as ACK ON or WATCH.
+bool is_add_line(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    return end - p >= 4 && std::memcmp(p, "ADD ", 4) == 0;
+}
+
+// Streams one newline-aligned slice of the mmap'd file over its own connection. Runs of
+// ADD lines go out as iovecs, up to BULK_BATCH_BYTES per writev (other lines are skipped),
+// and the worker finishes once the bar has acked every one (so the rate reflects applied
+// ADDs).
+constexpr size_t BULK_BATCH_BYTES = 256 * 1024;
+
+void bulk_worker(int sockfd, const char* begin, const char* end, BulkResult& result) {
+    static const char newline[] = "\n";
+    const char on[] = "ACK ON\n";
+    if (send(sockfd, on, sizeof(on) - 1, MSG_NOSIGNAL) < 0) {
+        result.ok = false;
+        return;
+    }
+
+    std::string pending;
+    std::vector<iovec> iov;
+    const char* p = begin;
+    while (p < end && result.ok) {
+        iov.clear();
+        size_t batch = 0;
+        while (p < end && batch < BULK_BATCH_BYTES && iov.size() + 2 < IOV_MAX) {
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            const char* line_end = nl ? nl + 1 : end;
+            if (is_add_line(p, line_end)) {
+                ++result.lines;
+                if (!iov.empty() && (char*)iov.back().iov_base + iov.back().iov_len == p) {
+                    iov.back().iov_len += line_end - p;
+                } else {
+                    iov.push_back({const_cast<char*>(p), (size_t)(line_end - p)});
+                }
+                if (!nl) iov.push_back({const_cast<char*>(newline), 1});
+                batch += line_end - p;
+            }
+            p = line_end;
         }
 
-        sockaddr_in server_addr{};
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(port);
-        std::memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+        size_t first = 0;
+        while (first < iov.size()) {
+            ssize_t sent = writev(sockfd, iov.data() + first, (int)std::min(iov.size() - first, (size_t)IOV_MAX));
+            if (sent < 0) {
+                perror("writev");
+                result.ok = false;
+                break;
+            }
+            while (first < iov.size() && (size_t)sent >= iov[first].iov_len) sent -= iov[first++].iov_len;
+            if (first < iov.size()) {
+                iov[first].iov_base = (char*)iov[first].iov_base + sent;
+                iov[first].iov_len -= sent;
+            }
+        }
+        if (!drain_acks(sockfd, pending, result.acked, MSG_DONTWAIT)) result.ok = false;
+    }
 
-        if (connect(sockfd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            perror("connect (TCP)");
-            close(sockfd);
+    timeval tv{10, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while (result.ok && result.acked < result.lines && drain_acks(sockfd, pending, result.acked, 0)) {}
+}
+
+int run_bulk(const std::string& path, int conns, const std::string& uds_path, const char* hostname, int port) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror("open (bulk file)");
+        return 1;
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    const char* data = nullptr;
+    if (size > 0) {
+        data = static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
             return 1;
         }
+        madvise(const_cast<char*>(data), size, MADV_SEQUENTIAL);
+    }
+
+    // Cut the file into one newline-aligned slice per connection.
+    std::vector<const char*> cuts = {data};
+    for (int i = 1; i < conns; ++i) {
+        const char* guess = data + size * i / conns;
+        if (guess < cuts.back()) guess = cuts.back();
+        const char* nl = static_cast<const char*>(std::memchr(guess, '\n', data + size - guess));
+        cuts.push_back(nl ? nl + 1 : data + size);
+    }
+    cuts.push_back(data + size);
+
+    std::vector<int> socks;
+    for (int i = 0; i < conns; ++i) {
+        int sockfd = connect_warehouse(uds_path, hostname, port);
+        if (sockfd < 0) return 1;
+        socks.push_back(sockfd);
+    }
+    std::cout << "Bulk loading " << path << " (" << size << " bytes) over " << conns << " connection(s)" << std::endl;
+
+    std::vector<BulkResult> results(conns);
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int i = 0; i < conns; ++i) {
+        workers.emplace_back(bulk_worker, socks[i], cuts[i], cuts[i + 1], std::ref(results[i]));
+    }
+    for (auto& w : workers) w.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t lines = 0, acked = 0;
+    bool ok = true;
+    for (const BulkResult& r : results) {
+        lines += r.lines;
+        acked += r.acked;
+        ok = ok && r.ok && r.acked == r.lines;
+    }
+    for (int sockfd : socks) close(sockfd);
+    if (data) munmap(const_cast<char*>(data), size);
+    close(fd);
+
+    std::cout << "Sent " << lines << " ADDs, " << acked << " acked in " << seconds << " s ("
+              << (seconds > 0 ? acked / seconds : 0) << " ADDs/s)" << std::endl;
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    bool ack_mode = false, busy_poll = false;
+    int uds_type = SOCK_STREAM;
+    std::string uds_path, bulk_path, shm_name;
+    int conns = 1;
+
+    static struct option long_options[] = {
+        {"bulk", required_argument, nullptr, 'b'},
+        {"conns", required_argument, nullptr, 'n'},
+        {"shm-busy-poll", no_argument, nullptr, 'B'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "af:m:q:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'a': ack_mode = true; break;
+            case 'f': uds_path = optarg; break;
+            case 'q':
+                uds_path = optarg;
+                uds_type = SOCK_SEQPACKET;
+                break;
+            case 'm': shm_name = optarg; break;
+            case 'B': busy_poll = true; break;
+            case 'b': bulk_path = optarg; break;
+            case 'n': conns = std::max(1, std::atoi(optarg)); break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
 
-        std::cout << "Connected to atom warehouse at " << hostname << ":" << port << std::endl;
+    if (!shm_name.empty()) {
+        if (argc != optind || !bulk_path.empty()) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        return run_shm(shm_name, ack_mode, busy_poll);
     }
 
-    // Invalid usage
-    else {
+    const char* hostname = nullptr;
+    int port = 0;
+    if (uds_path.empty()) {
+        if (argc - optind != 2) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        hostname = argv[optind];
+        try {
+            port = std::stoi(argv[optind + 1]);
+        } catch (...) {
+            std::cerr << "Invalid port number.\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    } else if (argc != optind) {
         print_usage(argv[0]);
         return 1;
     }
 
+    if (!bulk_path.empty()) {
+        if (uds_type != SOCK_STREAM) {
+            std::cerr << "--bulk needs a stream connection.\n";
+            return 1;
+        }
+        return run_bulk(bulk_path, conns, uds_path, hostname, port);
+    }
+
+    int sockfd = connect_warehouse(uds_path, hostname, port, uds_type);
+    if (sockfd < 0) return 1;
+    if (uds_type == SOCK_SEQPACKET) std::cout << "Connected to warehouse via UDS-SEQPACKET: " << uds_path << std::endl;
+    else if (!uds_path.empty()) std::cout << "Connected to warehouse via UDS: " << uds_path << std::endl;
+    else std::cout << "Connected to atom warehouse at " << hostname << ":" << port << std::endl;
+
+    AckTracker acks;
+    std::thread ack_reader;
+    if (ack_mode) {
+        const char on[] = "ACK ON\n";
+        send(sockfd, on, sizeof(on) - 1, 0);
+        ack_reader = std::thread(read_acks, sockfd, std::ref(acks));
+    }
+
     std::cout << "Enter commands (e.g., ADD HYDROGEN 50). Ctrl+D to quit.\n";
     std::string line;
     while (std::getline(std::cin, line)) {
         if (line.empty()) continue;
         line += "\n"; // Ensure newline
+        if (ack_mode) {
+            std::lock_guard<std::mutex> lock(acks.mu);
+            acks.sent_at.push_back(Clock::now());
+            ++acks.sent;
+        }
         ssize_t sent = send(sockfd, line.c_str(), line.size(), 0);
         if (sent < 0) {
             perror("send");
@@ -100,6 +440,17 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (ack_mode) {
+        std::unique_lock<std::mutex> lock(acks.mu);
+        acks.cv.wait_for(lock, std::chrono::seconds(2), [&] { return acks.acked == acks.sent; });
+        std::cout << "Acked " << acks.acked << "/" << acks.sent << " lines";
+        if (acks.acked > 0) std::cout << ", avg " << acks.total_ms / acks.acked << " ms, max " << acks.max_ms << " ms";
+        std::cout << std::endl;
+        lock.unlock();
+        shutdown(sockfd, SHUT_RDWR);
+        ack_reader.join();
+    }
+
     std::cout << "Disconnected.\n";
     close(sockfd);
     return 0;
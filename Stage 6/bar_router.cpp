@@ -0,0 +1,604 @@
+// File: bar_router.cpp
+// Description: Load-balancing front end for a pool of drinks_bar backends. Clients talk to it
+//              exactly as they would to one bar (TCP / UDS stream ADDs, UDP / UDS datagram
+//              DELIVERs, INVENTORY); each backend's SUBSCRIBE feed keeps a cached stock view
+//              that ADD spreading and DELIVER routing are decided from.
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <getopt.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include "command_parser.hpp"
+#include "timer_queue.hpp"
+
+#define BUFFER_SIZE 1024
+constexpr int RECONNECT_MS = 1000;
+
+enum SpreadPolicy { SPREAD_LEAST, SPREAD_ROUND_ROBIN };
+enum TimerKind : uint8_t { TIMER_DELIVER, TIMER_RECONNECT };
+
+// A client ADD forwarded to a backend. It is kept until that backend ACKs it, so the ADDs of a
+// backend that drops can be re-routed; the client's ACK only covers ADDs a backend applied.
+struct ForwardedAdd {
+    std::string line;
+    int atom;
+    int count;
+    int client_fd;
+    uint64_t client_id;
+    uint32_t client_seq;
+};
+
+// One drinks_bar. The stream connection carries ADD lines out and SUBSCRIBE feed lines and
+// ACKs back; DELIVERs go out as "FWD <seq> DELIVER ..." datagrams so replies can be matched.
+struct Backend {
+    std::string host;
+    int tcp_port;
+    int udp_port;
+    int stream_fd = -1;
+    int dgram_fd = -1;
+    std::string feed_buf;
+    std::string out;                    // ADD lines the socket has not taken yet
+    std::deque<ForwardedAdd> unacked;   // sent or queued here, not yet ACKed
+    uint32_t acked = 0;                 // ADDs this connection has ACKed
+    bool want_write = false;
+    int levels[STOCK_KEY_COUNT] = {};
+};
+
+struct Client {
+    uint64_t id = 0;  // tells a reused fd apart from the client an ADD came from
+    std::string inbuf;
+    bool ack_mode = false;
+    bool ack_dirty = false;
+    uint32_t seq = 0;                     // ADD lines received so far
+    uint32_t applied = 0;                 // leading ADDs a backend has ACKed (acked cumulatively)
+    std::set<uint32_t> applied_ahead;     // ACKed ADDs past a gap
+};
+
+// A datagram DELIVER split across backends, answered once every share is back.
+struct PendingDeliver {
+    int sock;
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    int mol;
+    int delivered;
+    int outstanding;
+    int request_tag;  // DELIVER ... TAG <n>, -1 when absent
+};
+
+std::vector<Backend> backends;
+std::unordered_map<int, Client> clients;
+std::unordered_map<uint64_t, PendingDeliver> pending;
+std::unordered_map<uint64_t, uint64_t> pending_share;  // FWD seq -> pending id
+std::deque<ForwardedAdd> unrouted;  // ADDs waiting for a backend to come up
+uint64_t next_seq = 1;
+uint64_t next_client_id = 1;
+uint64_t pool_version = 1;  // bumped on every change to the pooled stock view
+size_t round_robin = 0;
+SpreadPolicy spread = SPREAD_LEAST;
+int deliver_timeout_ms = 500;
+int epoll_fd = -1;
+int tcp_sock = -1, udp_sock = -1, uds_stream_sock = -1, uds_dgram_sock = -1;
+TimerQueue timers;
+
+int64_t now_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " -T <tcp_port> -U <udp_port> [-s stream_path] [-d dgram_path]"
+              << " -b <host:tcp_port:udp_port> [-b ...] [--spread least|round-robin] [--deliver-timeout MS]\n";
+    std::cerr << "  least: each ADD goes to the backend holding the least of that atom (default)\n";
+}
+
+void watch_fd(int fd, uint32_t events, int op = EPOLL_CTL_ADD) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) perror("epoll_ctl");
+}
+
+// === Backends ===
+
+bool resolve(const std::string& host, int port, sockaddr_in& addr) {
+    hostent* server = gethostbyname(host.c_str());
+    if (!server) return false;
+    addr = sockaddr_in{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    std::memcpy(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    return true;
+}
+
+void reroute_held_adds();
+
+void drop_backend(Backend& b) {
+    std::cerr << "[ROUTER] Backend " << b.host << ":" << b.tcp_port << " is down" << std::endl;
+    for (int* fd : {&b.stream_fd, &b.dgram_fd}) {
+        if (*fd < 0) continue;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, *fd, nullptr);
+        close(*fd);
+        *fd = -1;
+    }
+    b.feed_buf.clear();
+    b.out.clear();
+    b.want_write = false;
+    b.acked = 0;
+    std::fill(b.levels, b.levels + STOCK_KEY_COUNT, 0);
+    ++pool_version;
+    // An ADD the backend never ACKed may or may not have been applied; sending it again
+    // elsewhere can count it twice, dropping it can lose stock the client was told about.
+    std::move(b.unacked.begin(), b.unacked.end(), std::back_inserter(unrouted));
+    b.unacked.clear();
+    reroute_held_adds();
+    timers.schedule(now_ms() + RECONNECT_MS, TIMER_RECONNECT, &b - backends.data());
+}
+
+bool connect_backend(Backend& b) {
+    sockaddr_in stream_addr, dgram_addr;
+    if (!resolve(b.host, b.tcp_port, stream_addr) || !resolve(b.host, b.udp_port, dgram_addr)) return false;
+    b.stream_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    b.dgram_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (connect(b.stream_fd, (sockaddr*)&stream_addr, sizeof(stream_addr)) < 0 ||
+        connect(b.dgram_fd, (sockaddr*)&dgram_addr, sizeof(dgram_addr)) < 0) {
+        drop_backend(b);
+        return false;
+    }
+    int one = 1;
+    setsockopt(b.stream_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // The SNAPSHOT the feed starts with fills the stock view; ACKs tell which ADDs were applied.
+    const char subscribe[] = "SUBSCRIBE\nACK ON\n";
+    send(b.stream_fd, subscribe, sizeof(subscribe) - 1, MSG_NOSIGNAL);
+    fcntl(b.stream_fd, F_SETFL, fcntl(b.stream_fd, F_GETFL) | O_NONBLOCK);
+    watch_fd(b.stream_fd, EPOLLIN);
+    watch_fd(b.dgram_fd, EPOLLIN);
+    std::cout << "[ROUTER] Backend " << b.host << ":" << b.tcp_port << "/" << b.udp_port << " connected" << std::endl;
+    ++pool_version;
+    reroute_held_adds();
+    return true;
+}
+
+Backend* backend_by_fd(int fd) {
+    for (Backend& b : backends) {
+        if (b.stream_fd == fd || b.dgram_fd == fd) return &b;
+    }
+    return nullptr;
+}
+
+// "SNAPSHOT|DELTA <version> KEY=level;..." from a backend's feed.
+void apply_feed_line(Backend& b, std::string_view line) {
+    size_t first = line.find(' ');
+    size_t second = first == std::string_view::npos ? first : line.find(' ', first + 1);
+    if (second == std::string_view::npos) return;
+    ++pool_version;
+    for (size_t pos = second + 1; pos < line.size();) {
+        size_t eq = line.find('=', pos), end = line.find(';', pos);
+        if (eq == std::string_view::npos || end == std::string_view::npos || eq > end) break;
+        int key = stock_key_id(line.data() + pos, eq - pos);
+        if (key >= 0) b.levels[key] = std::atoi(std::string(line.substr(eq + 1, end - eq - 1)).c_str());
+        pos = end + 1;
+    }
+}
+
+void credit_client(Client& client, uint32_t seq) {
+    client.applied_ahead.insert(seq);
+    while (!client.applied_ahead.empty() && *client.applied_ahead.begin() == client.applied + 1) {
+        client.applied_ahead.erase(client.applied_ahead.begin());
+        ++client.applied;
+        client.ack_dirty = client.ack_mode;
+    }
+}
+
+// "ACK <n>": the backend has applied the first n ADDs sent on this connection.
+void credit_backend_acks(Backend& b, uint32_t n) {
+    for (; b.acked < n && !b.unacked.empty(); ++b.acked) {
+        const ForwardedAdd& add = b.unacked.front();
+        auto it = clients.find(add.client_fd);
+        if (it != clients.end() && it->second.id == add.client_id) credit_client(it->second, add.client_seq);
+        b.unacked.pop_front();
+    }
+}
+
+void read_backend_feed(Backend& b) {
+    char buffer[4096];
+    ssize_t len;
+    while ((len = recv(b.stream_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) b.feed_buf.append(buffer, len);
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        drop_backend(b);
+        return;
+    }
+    size_t start = 0;
+    for (size_t nl; (nl = b.feed_buf.find('\n', start)) != std::string::npos; start = nl + 1) {
+        std::string_view line(b.feed_buf.data() + start, nl - start);
+        if (line.compare(0, 9, "SNAPSHOT ") == 0 || line.compare(0, 6, "DELTA ") == 0) apply_feed_line(b, line);
+        else if (line.compare(0, 4, "ACK ") == 0) credit_backend_acks(b, std::strtoul(std::string(line.substr(4)).c_str(), nullptr, 10));
+    }
+    b.feed_buf.erase(0, start);
+}
+
+void flush_backend(Backend& b) {
+    if (b.stream_fd < 0 || b.out.empty()) return;
+    ssize_t sent = send(b.stream_fd, b.out.data(), b.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        drop_backend(b);
+        return;
+    }
+    b.out.erase(0, sent > 0 ? sent : 0);
+    bool want_write = !b.out.empty();
+    if (want_write != b.want_write) {
+        watch_fd(b.stream_fd, want_write ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+        b.want_write = want_write;
+    }
+}
+
+// === Routing ===
+
+Backend* pick_add_backend(int atom) {
+    Backend* best = nullptr;
+    for (size_t i = 0; i < backends.size(); ++i) {
+        Backend& b = backends[(round_robin + i) % backends.size()];
+        if (b.stream_fd < 0) continue;
+        if (spread == SPREAD_ROUND_ROBIN) {
+            round_robin = (&b - backends.data() + 1) % backends.size();
+            return &b;
+        }
+        if (!best || b.levels[atom] < best->levels[atom]) best = &b;
+    }
+    return best;
+}
+
+void route_add(ForwardedAdd add) {
+    Backend* b = pick_add_backend(add.atom);
+    if (!b) {
+        if (unrouted.empty()) std::cerr << "[ROUTER] No backend up; holding ADDs until one is" << std::endl;
+        unrouted.push_back(std::move(add));
+        return;
+    }
+    b->out.append(add.line).push_back('\n');
+    b->levels[add.atom] += add.count;  // until the feed confirms it
+    ++pool_version;
+    b->unacked.push_back(std::move(add));
+}
+
+void reroute_held_adds() {
+    if (unrouted.empty() || !pick_add_backend(unrouted.front().atom)) return;
+    std::deque<ForwardedAdd> held;
+    held.swap(unrouted);
+    for (ForwardedAdd& add : held) route_add(std::move(add));
+}
+
+int capacity(const Backend& b, int mol) {
+    int possible = INT_MAX;
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        if (MOLECULE_RECIPES[mol][a] > 0) possible = std::min(possible, b.levels[a] / MOLECULE_RECIPES[mol][a]);
+    }
+    return possible;
+}
+
+// A tagged DELIVER gets " TAG <n>" at the end of its reply, as from a single bar.
+std::string tag_reply(std::string reply, int request_tag) {
+    if (request_tag >= 0) reply += " TAG " + std::to_string(request_tag);
+    return reply;
+}
+
+void finish_deliver(uint64_t id) {
+    auto it = pending.find(id);
+    if (it == pending.end()) return;
+    const PendingDeliver& p = it->second;
+    std::string reply = tag_reply(p.delivered > 0 ? "OK " + std::to_string(p.delivered) : "FAILED", p.request_tag);
+    sendto(p.sock, reply.data(), reply.size(), 0, (const sockaddr*)&p.addr, p.addrlen);
+    pending.erase(it);
+}
+
+// Splits a DELIVER across the backends that look able to make it, most stock first. A backend
+// whose send fails is skipped for the rest of this DELIVER.
+void route_deliver(int sock, const sockaddr* addr, socklen_t addrlen, const ParsedCommand& cmd) {
+    uint64_t id = next_seq++;
+    PendingDeliver p{sock, {}, addrlen, cmd.id, 0, 0, cmd.request_tag};
+    std::memcpy(&p.addr, addr, addrlen);
+    std::vector<bool> skip(backends.size());
+    int missing = cmd.count;
+    while (missing > 0) {
+        Backend* best = nullptr;
+        int best_capacity = 0;
+        for (Backend& b : backends) {
+            int c = b.dgram_fd >= 0 && !skip[&b - backends.data()] ? capacity(b, cmd.id) : 0;
+            if (c > best_capacity) {
+                best = &b;
+                best_capacity = c;
+            }
+        }
+        if (!best) break;
+        int share = std::min(missing, best_capacity);
+        uint64_t seq = next_seq++;
+        std::string request = "FWD " + std::to_string(seq) + " DELIVER " + MOLECULE_NAMES[cmd.id] + " " + std::to_string(share);
+        if (send(best->dgram_fd, request.data(), request.size(), MSG_DONTWAIT) < 0) {
+            skip[best - backends.data()] = true;
+            continue;
+        }
+        for (int a = 0; a < ATOM_COUNT; ++a) best->levels[a] -= MOLECULE_RECIPES[cmd.id][a] * share;
+        missing -= share;
+        ++pool_version;
+        pending_share[seq] = id;
+        ++p.outstanding;
+    }
+    if (p.outstanding == 0) {
+        std::string reply = tag_reply("FAILED", cmd.request_tag);
+        sendto(sock, reply.data(), reply.size(), 0, addr, addrlen);
+        return;
+    }
+    pending[id] = p;
+    timers.schedule(now_ms() + deliver_timeout_ms, TIMER_DELIVER, id);
+}
+
+// "FWD <seq> OK <n>" / "FWD <seq> FAILED" from a backend.
+void read_backend_replies(Backend& b) {
+    char buffer[BUFFER_SIZE];
+    ssize_t len;
+    while ((len = recv(b.dgram_fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT)) > 0) {
+        buffer[len] = '\0';
+        if (std::strncmp(buffer, "FWD ", 4) != 0) continue;
+        char* rest = nullptr;
+        auto share = pending_share.find(std::strtoull(buffer + 4, &rest, 10));
+        if (share == pending_share.end()) continue;  // answered after the client was
+        auto p = pending.find(share->second);
+        pending_share.erase(share);
+        if (p == pending.end()) continue;
+        if (std::strncmp(rest, " OK ", 4) == 0) p->second.delivered += std::atoi(rest + 4);
+        if (--p->second.outstanding == 0) finish_deliver(p->first);
+    }
+}
+
+void expire_deliver(uint64_t id) {
+    if (pending.find(id) == pending.end()) return;
+    for (auto it = pending_share.begin(); it != pending_share.end();) {
+        it = it->second == id ? pending_share.erase(it) : std::next(it);
+    }
+    std::cerr << "[ROUTER] DELIVER timed out waiting for backends" << std::endl;
+    finish_deliver(id);
+}
+
+// Pool-wide INVENTORY [IF-NEWER <version>]: per-key sums over the live backends, versioned by
+// pool_version. As in drinks_bar, only an exact match is NOT-MODIFIED, since the counter starts
+// again when the router restarts. Returns an empty string for anything else.
+std::string inventory_reply(std::string_view request, bool newline) {
+    constexpr std::string_view if_newer = "INVENTORY IF-NEWER ";
+    if (request.compare(0, if_newer.size(), if_newer) == 0) {
+        std::string known(request.substr(if_newer.size()));
+        char* end = nullptr;
+        unsigned long long version = std::strtoull(known.c_str(), &end, 10);
+        if (known.empty() || !std::isdigit((unsigned char)known[0]) || *end != '\0') return std::string();
+        if (version == pool_version) return "NOT-MODIFIED " + std::to_string(pool_version) + (newline ? "\n" : "");
+    } else if (request != "INVENTORY") {
+        return std::string();
+    }
+    int totals[STOCK_KEY_COUNT] = {};
+    for (const Backend& b : backends) {
+        if (b.stream_fd < 0) continue;
+        for (int key = 0; key < STOCK_KEY_COUNT; ++key) totals[key] += b.levels[key];
+    }
+    std::string out = "INVENTORY " + std::to_string(pool_version) + " ";
+    for (int key = 0; key < STOCK_KEY_COUNT; ++key) {
+        out.append(stock_key_name(key)).append("=").append(std::to_string(totals[key])).append(";");
+    }
+    if (newline) out += '\n';
+    return out;
+}
+
+// === Clients ===
+
+void handle_datagram(int sock) {
+    char buffer[BUFFER_SIZE];
+    sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    ssize_t len = recvfrom(sock, buffer, sizeof(buffer), 0, (sockaddr*)&addr, &addrlen);
+    if (len <= 0) return;
+    ParsedCommand cmd{};
+    size_t consumed = 0;
+    bool deliver = parse_command_batch(buffer, len, &cmd, 1, true, &consumed) == 1 && cmd.op == OP_DELIVER;
+    if (deliver && cmd.id >= 0) {
+        route_deliver(sock, (sockaddr*)&addr, addrlen, cmd);
+        return;
+    }
+    std::string_view request(buffer, len);
+    while (!request.empty() && (request.back() == '\n' || request.back() == '\r')) request.remove_suffix(1);
+    std::string reply = inventory_reply(request, false);
+    if (reply.empty()) reply = tag_reply("FAILED", deliver ? cmd.request_tag : -1);
+    sendto(sock, reply.data(), reply.size(), 0, (sockaddr*)&addr, addrlen);
+}
+
+void close_client(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    clients.erase(fd);
+}
+
+void handle_client(int fd, Client& client) {
+    char buffer[16384];
+    ssize_t len = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    bool closing = len <= 0;
+    if (!closing) client.inbuf.append(buffer, len);
+
+    size_t max_cmds = client.inbuf.size() / 2 + 1;
+    std::vector<ParsedCommand> cmds(max_cmds);
+    size_t consumed = 0;
+    size_t n = parse_command_batch(client.inbuf.data(), client.inbuf.size(), cmds.data(), max_cmds, closing, &consumed);
+    for (size_t i = 0; i < n; ++i) {
+        std::string_view line(client.inbuf.data() + cmds[i].offset, cmds[i].length);
+        std::string reply;
+        if (cmds[i].op == OP_ADD && cmds[i].id >= 0) {
+            route_add(ForwardedAdd{std::string(line), cmds[i].id, cmds[i].count, fd, client.id, ++client.seq});
+        } else if (line == "ACK ON" || line == "ACK OFF") {
+            client.ack_mode = line == "ACK ON";
+        } else if (!(reply = inventory_reply(line, true)).empty()) {
+            send(fd, reply.data(), reply.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        } else {
+            std::cerr << "[ROUTER] Unsupported stream command: " << line << std::endl;
+        }
+    }
+    client.inbuf.erase(0, consumed);
+    if (closing) close_client(fd);
+}
+
+void accept_clients(int listen_sock) {
+    while (true) {
+        int fd = accept4(listen_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        if (listen_sock == tcp_sock) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        clients[fd].id = next_client_id++;
+        watch_fd(fd, EPOLLIN);
+    }
+}
+
+// A client's ACK covers the ADDs backends have ACKed, so a backend that drops loses none of them.
+void flush_acks() {
+    for (auto& [fd, client] : clients) {
+        if (!client.ack_dirty) continue;
+        client.ack_dirty = false;
+        std::string ack = "ACK " + std::to_string(client.applied) + "\n";
+        send(fd, ack.data(), ack.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+int open_listener(int domain, int type, const sockaddr* addr, socklen_t addrlen) {
+    int fd = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (domain == AF_INET && type == SOCK_STREAM) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, addr, addrlen) < 0 || (type == SOCK_STREAM && listen(fd, 128) < 0)) {
+        perror("[ERROR] listener");
+        return -1;
+    }
+    watch_fd(fd, EPOLLIN);
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    int tcp_port = -1, udp_port = -1;
+    std::string stream_path, dgram_path;
+    static struct option long_options[] = {
+        {"backend", required_argument, nullptr, 'b'},
+        {"spread", required_argument, nullptr, 'p'},
+        {"deliver-timeout", required_argument, nullptr, 'w'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "T:U:s:d:b:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'T': tcp_port = std::atoi(optarg); break;
+            case 'U': udp_port = std::atoi(optarg); break;
+            case 's': stream_path = optarg; break;
+            case 'd': dgram_path = optarg; break;
+            case 'b': {
+                std::string spec = optarg;
+                size_t second = spec.rfind(':');
+                size_t first = second == std::string::npos || second == 0 ? std::string::npos : spec.rfind(':', second - 1);
+                if (first == std::string::npos) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                Backend b;
+                b.host = spec.substr(0, first);
+                b.tcp_port = std::atoi(spec.c_str() + first + 1);
+                b.udp_port = std::atoi(spec.c_str() + second + 1);
+                backends.push_back(b);
+                break;
+            }
+            case 'p':
+                if (std::strcmp(optarg, "round-robin") == 0) spread = SPREAD_ROUND_ROBIN;
+                else if (std::strcmp(optarg, "least") == 0) spread = SPREAD_LEAST;
+                else {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w': deliver_timeout_ms = std::atoi(optarg); break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (tcp_port < 0 || udp_port < 0 || backends.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    epoll_fd = epoll_create1(0);
+    for (Backend& b : backends) connect_backend(b);
+
+    sockaddr_in in_addr{};
+    in_addr.sin_family = AF_INET;
+    in_addr.sin_addr.s_addr = INADDR_ANY;
+    in_addr.sin_port = htons(tcp_port);
+    tcp_sock = open_listener(AF_INET, SOCK_STREAM, (sockaddr*)&in_addr, sizeof(in_addr));
+    in_addr.sin_port = htons(udp_port);
+    udp_sock = open_listener(AF_INET, SOCK_DGRAM, (sockaddr*)&in_addr, sizeof(in_addr));
+    if (tcp_sock < 0 || udp_sock < 0) return 1;
+    for (auto [path, type, sock] : {std::make_tuple(&stream_path, SOCK_STREAM, &uds_stream_sock),
+                                    std::make_tuple(&dgram_path, SOCK_DGRAM, &uds_dgram_sock)}) {
+        if (path->empty()) continue;
+        sockaddr_un un_addr{};
+        un_addr.sun_family = AF_UNIX;
+        strncpy(un_addr.sun_path, path->c_str(), sizeof(un_addr.sun_path) - 1);
+        unlink(un_addr.sun_path);
+        *sock = open_listener(AF_UNIX, type, (sockaddr*)&un_addr, sizeof(un_addr));
+        if (*sock < 0) return 1;
+    }
+    std::cout << "Bar router started with " << backends.size() << " backend(s).\n";
+
+    epoll_event events[64];
+    while (true) {
+        int ready = epoll_wait(epoll_fd, events, 64, timers.timeout_ms(now_ms()));
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == tcp_sock || fd == uds_stream_sock) {
+                accept_clients(fd);
+            } else if (fd == udp_sock || fd == uds_dgram_sock) {
+                handle_datagram(fd);
+            } else if (Backend* b = backend_by_fd(fd)) {
+                if (fd == b->dgram_fd) read_backend_replies(*b);
+                else if (events[i].events & EPOLLIN) read_backend_feed(*b);
+            } else if (clients.count(fd)) {
+                handle_client(fd, clients[fd]);
+            }
+        }
+        timers.run_expired(now_ms(), [](const TimerEntry& timer) {
+            if (timer.kind == TIMER_DELIVER) expire_deliver(timer.token);
+            else if (backends[timer.token].stream_fd < 0) connect_backend(backends[timer.token]);
+        });
+        for (Backend& b : backends) flush_backend(b);
+        flush_acks();
+    }
+    return 0;
+}
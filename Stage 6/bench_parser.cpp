@@ -0,0 +1,80 @@
+// File: bench_parser.cpp
+// Description: Microbenchmark for command_parser.hpp - commands/second on one core
+//              for the batch parser, against the old sscanf path.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include "command_parser.hpp"
+
+static std::string make_batch(size_t lines) {
+    static const char* const samples[] = {
+        "ADD HYDROGEN 50\n", "ADD OXYGEN 7\n", "ADD CARBON 123456\n",
+        "DELIVER WATER 2\n", "DELIVER CARBON DIOXIDE 10\n", "DELIVER GLUCOSE\n",
+    };
+    std::string out;
+    for (size_t i = 0; i < lines; ++i) out += samples[i % 6];
+    return out;
+}
+
+// What handle_tcp_command / handle_udp_command did per line before the batch parser.
+static size_t legacy_parse(const std::string& batch) {
+    size_t parsed = 0;
+    std::istringstream lines(batch);
+    std::string line;
+    while (std::getline(lines, line)) {
+        char type_buf[64];
+        int amount;
+        if (sscanf(line.c_str(), "ADD %63s %d", type_buf, &amount) == 2) {
+            ++parsed;
+            continue;
+        }
+        std::istringstream iss(line);
+        std::string word, molecule;
+        iss >> word >> std::ws;
+        std::getline(iss, molecule);
+        size_t pos = molecule.find_last_of(' ');
+        if (pos != std::string::npos && isdigit(molecule[pos + 1])) {
+            amount = std::stoi(molecule.substr(pos + 1));
+            molecule = molecule.substr(0, pos);
+        }
+        ++parsed;
+    }
+    return parsed;
+}
+
+static void report(const char* name, size_t commands, double seconds) {
+    printf("%-10s %12.0f commands/s  (%.2f ns/command)\n", name, commands / seconds, seconds * 1e9 / commands);
+}
+
+int main(int argc, char* argv[]) {
+    size_t lines = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 10;
+    std::string batch = make_batch(lines);
+    std::vector<ParsedCommand> out(lines + 1);
+
+    std::cout << "Parsing " << lines << " lines (" << batch.size() << " bytes) x " << rounds << " rounds\n";
+
+    size_t total = 0, consumed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        total += parse_command_batch(batch.data(), batch.size(), out.data(), out.size(), true, &consumed);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (total != lines * rounds || out[lines - 1].op == OP_INVALID) {
+        std::cerr << "batch: parsed " << total << " records, expected " << lines * rounds << "\n";
+        return 1;
+    }
+    report("batch", total, elapsed.count());
+
+    start = std::chrono::steady_clock::now();
+    total = 0;
+    for (int r = 0; r < rounds; ++r) total += legacy_parse(batch);
+    elapsed = std::chrono::steady_clock::now() - start;
+    report("sscanf", total, elapsed.count());
+    return 0;
+}
@@ -0,0 +1,115 @@
+// File: bench_reconnect_storm.cpp
+// Description: Reconnect-storm benchmark. Opens N supplier connections to drinks_bar at
+//              once (non-blocking connects), sends one ADD on each, then drops them all and
+//              repeats. Reports how long each storm takes to be fully connected.
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// One storm: returns per-connection connect latencies in ms (negative for failures).
+static std::vector<double> run_storm(const sockaddr_in& addr, int clients) {
+    std::vector<int> socks(clients, -1);
+    std::vector<double> latency(clients, -1.0);
+    int ep = epoll_create1(0);
+    auto start = Clock::now();
+    int pending = 0;
+
+    for (int i = 0; i < clients; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            perror("socket");
+            break;
+        }
+        socks[i] = fd;
+        if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) continue;
+        epoll_event ev{};
+        ev.events = EPOLLOUT;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+        ++pending;
+    }
+
+    const char add[] = "ADD HYDROGEN 1\n";
+    std::vector<epoll_event> events(256);
+    while (pending > 0) {
+        int n = epoll_wait(ep, events.data(), (int)events.size(), 10000);
+        if (n <= 0) break;
+        for (int k = 0; k < n; ++k) {
+            int i = events[k].data.u32;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(socks[i], SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0 && send(socks[i], add, sizeof(add) - 1, MSG_NOSIGNAL) > 0) latency[i] = ms_since(start);
+            epoll_ctl(ep, EPOLL_CTL_DEL, socks[i], nullptr);
+            --pending;
+        }
+    }
+
+    for (int fd : socks) {
+        if (fd >= 0) close(fd);
+    }
+    close(ep);
+    return latency;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <HOSTNAME> <PORT> [clients=1000] [rounds=5]\n";
+        return 1;
+    }
+    int port = std::atoi(argv[2]);
+    int clients = argc > 3 ? std::atoi(argv[3]) : 1000;
+    int rounds = argc > 4 ? std::atoi(argv[4]) : 5;
+
+    rlimit lim{};
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+
+    hostent* server = gethostbyname(argv[1]);
+    if (!server) {
+        std::cerr << "Error: No such host.\n";
+        return 1;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    std::memcpy(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+
+    printf("%d clients x %d storms against %s:%d\n", clients, rounds, argv[1], port);
+    for (int r = 0; r < rounds; ++r) {
+        auto start = Clock::now();
+        std::vector<double> latency = run_storm(addr, clients);
+        double total = ms_since(start);
+
+        std::vector<double> ok;
+        for (double l : latency) {
+            if (l >= 0) ok.push_back(l);
+        }
+        std::sort(ok.begin(), ok.end());
+        auto pct = [&](double p) { return ok.empty() ? 0.0 : ok[std::min(ok.size() - 1, (size_t)(p * ok.size()))]; };
+        printf("storm %d: %zu/%d connected in %.1f ms  p50 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+               r + 1, ok.size(), clients, total, pct(0.50), pct(0.99), ok.empty() ? 0.0 : ok.back());
+        usleep(200 * 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// File: bench_uds_transports.cpp
+// Description: Local transport comparison against a running drinks_bar started with -s, -d
+//              and --seqpacket-path. One request in flight at a time:
+//                DELIVER      UDS datagram (bound client path) vs SEQPACKET
+//                ADD + ACK    UDS stream (ACK ON) vs SEQPACKET (ACK ON)
+//                per-client   setup, one DELIVER, teardown: datagram bind/unlink vs
+//                             SEQPACKET connect/close
+//              The bar needs enough stock for the DELIVERs (e.g. -o/-h/-c 100000000).
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "latency_histogram.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static sockaddr_un uds_address(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+static int connect_uds(const std::string& path, int type) {
+    int fd = socket(AF_UNIX, type, 0);
+    sockaddr_un addr = uds_address(path);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Datagram clients need their own bound path for the reply, as molecule_requester does.
+static int open_dgram(const std::string& client_path) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    sockaddr_un addr = uds_address(client_path);
+    unlink(client_path.c_str());
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one request and waits for its reply (for stream ADDs: the next ACK line).
+static bool round_trip(int fd, const sockaddr_un* to, const char* request, LatencyHistogram& latency) {
+    char reply[1024];
+    auto start = Clock::now();
+    ssize_t sent = to ? sendto(fd, request, std::strlen(request), 0, (const sockaddr*)to, sizeof(*to))
+                      : send(fd, request, std::strlen(request), MSG_NOSIGNAL);
+    if (sent < 0 || recv(fd, reply, sizeof(reply), 0) <= 0) return false;
+    latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    return true;
+}
+
+static void report(const char* label, size_t n, double seconds, const LatencyHistogram& latency) {
+    printf("%-26s %9.0f round trips/s\n", label, seconds > 0 ? n / seconds : 0.0);
+    latency.print(stdout, "  ");
+}
+
+// Times n round trips; returns false if the bar stopped answering.
+template <typename Fn>
+static bool run(const char* label, size_t n, Fn&& one) {
+    LatencyHistogram latency;
+    auto start = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        if (!one(latency)) {
+            fprintf(stderr, "%s: request %zu failed\n", label, i);
+            return false;
+        }
+    }
+    report(label, n, std::chrono::duration<double>(Clock::now() - start).count(), latency);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <STREAM_PATH> <DGRAM_PATH> <SEQPACKET_PATH> [ROUND_TRIPS]\n";
+        return 1;
+    }
+    std::string stream_path = argv[1], dgram_path = argv[2], seqpacket_path = argv[3];
+    size_t n = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 20000;
+    std::string client_path = "/tmp/bench_uds_client_" + std::to_string(getpid());
+    sockaddr_un bar_dgram = uds_address(dgram_path);
+
+    int dgram = open_dgram(client_path);
+    int seq = connect_uds(seqpacket_path, SOCK_SEQPACKET);
+    int stream = connect_uds(stream_path, SOCK_STREAM);
+    if (dgram < 0 || seq < 0 || stream < 0) return 1;
+    const char on[] = "ACK ON\n";
+    send(stream, on, sizeof(on) - 1, MSG_NOSIGNAL);
+    send(seq, on, sizeof(on) - 1, MSG_NOSIGNAL);
+
+    printf("%zu round trips per transport, one in flight\n", n);
+    bool ok = run("DELIVER  uds-dgram", n, [&](LatencyHistogram& l) { return round_trip(dgram, &bar_dgram, "DELIVER WATER 1", l); }) &&
+              run("DELIVER  seqpacket", n, [&](LatencyHistogram& l) { return round_trip(seq, nullptr, "DELIVER WATER 1", l); }) &&
+              run("ADD+ACK  uds-stream", n, [&](LatencyHistogram& l) { return round_trip(stream, nullptr, "ADD OXYGEN 1\n", l); }) &&
+              run("ADD+ACK  seqpacket", n, [&](LatencyHistogram& l) { return round_trip(seq, nullptr, "ADD OXYGEN 1\n", l); });
+    close(dgram);
+    close(seq);
+    close(stream);
+    unlink(client_path.c_str());
+
+    size_t clients = n / 10;
+    ok = ok && run("client+DELIVER uds-dgram", clients, [&](LatencyHistogram& l) {
+        auto start = Clock::now();
+        int fd = open_dgram(client_path);
+        LatencyHistogram ignored;
+        bool done = fd >= 0 && round_trip(fd, &bar_dgram, "DELIVER WATER 1", ignored);
+        if (fd >= 0) close(fd);
+        unlink(client_path.c_str());
+        l.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        return done;
+    });
+    ok = ok && run("client+DELIVER seqpacket", clients, [&](LatencyHistogram& l) {
+        auto start = Clock::now();
+        int fd = connect_uds(seqpacket_path, SOCK_SEQPACKET);
+        LatencyHistogram ignored;
+        bool done = fd >= 0 && round_trip(fd, nullptr, "DELIVER WATER 1", ignored);
+        if (fd >= 0) close(fd);
+        l.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        return done;
+    });
+    return ok ? 0 : 1;
+}
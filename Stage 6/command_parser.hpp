@@ -0,0 +1,212 @@
+// File: command_parser.hpp
+// Description: Batch parser for pipelined ADD / DELIVER text commands.
+//   A whole read is split into lines and tokens in one pass: each 64-byte block becomes a
+//   separator and a newline bitmask, and the token edges are walked from those.
+//   Grammar (one command per line):
+//     ADD <ATOM> <amount>
+//     DELIVER <MOLECULE> [count] [WAIT <ms>] [TAG <n>]
+//   Lines starting with any other word come back as OP_OTHER for the caller's slow path.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include "inventory_schema.hpp"
+
+enum Opcode : uint8_t { OP_INVALID, OP_ADD, OP_DELIVER, OP_OTHER };
+
+struct ParsedCommand {
+    Opcode op;
+    int8_t id;             // AtomId for ADD, MoleculeId for DELIVER, -1 for an unknown name
+    int32_t count;
+    int32_t wait_ms;       // DELIVER ... WAIT <ms>, 0 when absent
+    int32_t request_tag;   // DELIVER ... TAG <n>, echoed in the reply; -1 when absent
+    uint32_t offset;       // trimmed line inside the parsed buffer
+    uint32_t length;
+    uint32_t name_offset;  // raw name span, used when reporting unknown names
+    uint32_t name_length;
+};
+
+namespace parser_detail {
+
+constexpr int MAX_TOKENS = 8;
+constexpr size_t MAX_NAME = 64;
+
+struct LineState {
+    uint32_t line_start = 0;
+    int ntok = 0;
+    bool in_token = false;
+    uint32_t last_end = 0;  // end of the last token, even past MAX_TOKENS
+    uint32_t tok_start[MAX_TOKENS];
+    uint32_t tok_end[MAX_TOKENS];
+};
+
+inline bool is_sep(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+inline void scan_block(const char* p, size_t n, uint64_t* sep, uint64_t* nl) {
+    uint64_t s = 0, l = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (is_sep(p[i])) s |= 1ull << i;
+        if (p[i] == '\n') l |= 1ull << i;
+    }
+    *sep = s;
+    *nl = l;
+}
+
+inline bool parse_uint(const char* s, size_t len, int32_t* out) {
+    if (len == 0 || len > 10) return false;
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned d = (unsigned char)s[i] - '0';
+        if (d > 9) return false;
+        v = v * 10 + d;
+    }
+    if (v > INT_MAX) return false;
+    *out = (int32_t)v;
+    return true;
+}
+
+// Joins tokens [first, last] with single spaces so "CARBON   DIOXIDE" still matches.
+inline size_t join_tokens(const char* buf, const LineState& st, int first, int last, char* out) {
+    size_t n = 0;
+    for (int t = first; t <= last; ++t) {
+        size_t len = st.tok_end[t] - st.tok_start[t];
+        if (n + len + 1 > MAX_NAME) return MAX_NAME;
+        if (t != first) out[n++] = ' ';
+        std::memcpy(out + n, buf + st.tok_start[t], len);
+        n += len;
+    }
+    return n;
+}
+
+inline bool token_is(const char* buf, const LineState& st, int t, const char* word) {
+    size_t len = st.tok_end[t] - st.tok_start[t];
+    return std::strlen(word) == len && std::memcmp(buf + st.tok_start[t], word, len) == 0;
+}
+
+// Turns the tokens of one line into a record. Returns false only when out is full.
+inline bool finish_line(const char* buf, LineState& st, bool overflow, ParsedCommand* out,
+                        size_t& n, size_t max_out) {
+    if (st.ntok == 0) return true;
+    if (n == max_out) return false;
+
+    ParsedCommand& cmd = out[n++];
+    cmd.op = OP_INVALID;
+    cmd.id = -1;
+    cmd.count = 0;
+    cmd.wait_ms = 0;
+    cmd.request_tag = -1;
+    cmd.offset = st.tok_start[0];
+    cmd.length = st.last_end - st.tok_start[0];
+    cmd.name_offset = st.ntok > 1 ? st.tok_start[1] : cmd.offset + cmd.length;
+    cmd.name_length = 0;
+
+    char name[MAX_NAME];
+    bool is_add = token_is(buf, st, 0, "ADD"), is_deliver = token_is(buf, st, 0, "DELIVER");
+    if (!is_add && !is_deliver) {
+        cmd.op = OP_OTHER;
+    } else if (overflow) {
+        return true;
+    } else if (is_add && st.ntok == 3) {
+        cmd.name_length = st.tok_end[1] - st.tok_start[1];
+        if (!parse_uint(buf + st.tok_start[2], st.tok_end[2] - st.tok_start[2], &cmd.count)) return true;
+        cmd.op = OP_ADD;
+        cmd.id = (int8_t)atom_id(buf + cmd.name_offset, cmd.name_length);
+    } else if (is_deliver && st.ntok >= 2) {
+        int last_name = st.ntok - 1;
+        cmd.count = 1;
+        if (st.ntok >= 4 && token_is(buf, st, last_name - 1, "TAG")) {
+            if (!parse_uint(buf + st.tok_start[last_name], st.tok_end[last_name] - st.tok_start[last_name], &cmd.request_tag)) {
+                return true;
+            }
+            last_name -= 2;
+        }
+        if (last_name >= 3 && token_is(buf, st, last_name - 1, "WAIT")) {
+            if (!parse_uint(buf + st.tok_start[last_name], st.tok_end[last_name] - st.tok_start[last_name], &cmd.wait_ms)) {
+                return true;
+            }
+            last_name -= 2;
+        }
+        if (last_name >= 2 && parse_uint(buf + st.tok_start[last_name], st.tok_end[last_name] - st.tok_start[last_name], &cmd.count)) {
+            --last_name;
+        }
+        cmd.name_length = st.tok_end[last_name] - st.tok_start[1];
+        cmd.op = OP_DELIVER;
+        size_t len = join_tokens(buf, st, 1, last_name, name);
+        cmd.id = len < MAX_NAME ? (int8_t)molecule_id(name, len) : -1;
+    }
+    return true;
+}
+
+inline size_t parse_batch(const char* buf, size_t len, ParsedCommand* out, size_t max_out,
+                          bool final, size_t* consumed) {
+    LineState st;
+    bool overflow = false;
+    bool prev_sep = true;
+    size_t n = 0, done = 0;
+
+    for (size_t pos = 0; pos < len; pos += 64) {
+        size_t w = len - pos < 64 ? len - pos : 64;
+        uint64_t sep, nl;
+        scan_block(buf + pos, w, &sep, &nl);
+
+        // Token edges are where the separator mask flips; newlines close the line.
+        uint64_t live = w == 64 ? ~0ull : (1ull << w) - 1;
+        uint64_t edges = ((sep ^ ((sep << 1) | (prev_sep ? 1 : 0))) | nl) & live;
+        prev_sep = (sep >> (w - 1)) & 1;
+
+        while (edges) {
+            int bit = __builtin_ctzll(edges);
+            edges &= edges - 1;
+            uint32_t p = (uint32_t)(pos + bit);
+            if ((sep >> bit) & 1) {
+                if (st.in_token) {
+                    if (st.ntok < MAX_TOKENS) st.tok_end[st.ntok++] = p;
+                    else overflow = true;
+                    st.last_end = p;
+                    st.in_token = false;
+                }
+                if ((nl >> bit) & 1) {
+                    if (!finish_line(buf, st, overflow, out, n, max_out)) {
+                        *consumed = st.line_start;
+                        return n;
+                    }
+                    st.ntok = 0;
+                    overflow = false;
+                    st.line_start = p + 1;
+                    done = p + 1;
+                }
+            } else {
+                if (st.ntok < MAX_TOKENS) st.tok_start[st.ntok] = p;
+                st.in_token = true;
+            }
+        }
+    }
+
+    if (final) {
+        if (st.in_token) {
+            if (st.ntok < MAX_TOKENS) st.tok_end[st.ntok++] = (uint32_t)len;
+            else overflow = true;
+            st.last_end = (uint32_t)len;
+        }
+        if (!finish_line(buf, st, overflow, out, n, max_out)) {
+            *consumed = st.line_start;
+            return n;
+        }
+        done = len;
+    }
+    *consumed = done;
+    return n;
+}
+
+} // namespace parser_detail
+
+// Parses every complete line of buf into out (at most max_out records, blank lines skipped).
+// When final is false a trailing line without '\n' is left unparsed; *consumed always tells
+// how many bytes were fully handled so the caller can keep the rest for the next read.
+inline size_t parse_command_batch(const char* buf, size_t len, ParsedCommand* out, size_t max_out,
+                                  bool final, size_t* consumed) {
+    return parser_detail::parse_batch(buf, len, out, max_out, final, consumed);
+}
@@ -0,0 +1,202 @@
+// File: command_trace.hpp
+// Description: Binary trace of inbound bar commands. The event loop appends fixed-size
+//              records into a lock-free single-producer ring and a background thread
+//              streams the ring to disk; trace_replay reads the same format back.
+//
+//   File  := TraceFileHeader TraceRecord*
+//   Record:= TraceRecord header, then text_len bytes of the raw command line. Text is only
+//            stored when opcode/id/count cannot rebuild the line (unknown names, other
+//            verbs, console input).
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "command_parser.hpp"
+
+constexpr char TRACE_MAGIC[8] = {'D', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// New transports go at the end, so older traces keep their meaning.
+enum TraceTransport : uint8_t {
+    TRACE_TCP, TRACE_UDP, TRACE_UDS_STREAM, TRACE_UDS_DGRAM, TRACE_CONSOLE, TRACE_SHM, TRACE_SEQPACKET
+};
+
+inline const char* trace_transport_name(uint8_t t) {
+    static const char* const names[] = {"tcp", "udp", "uds-stream", "uds-dgram", "console", "shm", "seqpacket"};
+    return t <= TRACE_SEQPACKET ? names[t] : "?";
+}
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct TraceRecord {
+    uint64_t timestamp_ns;  // since the trace was opened
+    uint32_t client;        // connection generation for stream clients, address hash for datagram clients,
+                            // claim serial for shared-memory channels
+    uint8_t transport;      // TraceTransport
+    uint8_t opcode;         // Opcode
+    int8_t id;
+    uint8_t reserved;
+    int32_t count;
+    uint16_t text_len;
+    uint16_t reserved2;
+};
+static_assert(sizeof(TraceRecord) == 24, "trace records are written as raw bytes");
+
+inline uint64_t trace_clock_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// FNV-1a over a socket address, so each datagram client gets a stable trace id.
+inline uint32_t trace_client_id(const void* addr, size_t len) {
+    uint32_t h = 2166136261u;
+    const unsigned char* p = static_cast<const unsigned char*>(addr);
+    for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+class TraceWriter {
+public:
+    ~TraceWriter() { close(); }
+
+    bool open(const std::string& path, size_t ring_bytes = 1 << 22) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        TraceFileHeader header{};
+        std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = 1;
+        header.record_size = sizeof(TraceRecord);
+        if (::write(fd_, &header, sizeof(header)) != (ssize_t)sizeof(header)) return false;
+
+        size_t cap = 1;
+        while (cap < ring_bytes) cap <<= 1;
+        ring_.assign(cap, 0);
+        mask_ = cap - 1;
+        start_ns_ = trace_clock_ns();
+        thread_ = std::thread(&TraceWriter::run, this);
+        return true;
+    }
+
+    bool enabled() const { return fd_ >= 0; }
+    uint64_t dropped() const { return dropped_; }
+
+    // Commands parsed out of one read share a timestamp, so batches pay for one clock read.
+    uint64_t stamp() const { return trace_clock_ns() - start_ns_; }
+
+    // Producer side, event-loop thread only: no locks and no syscalls. A full ring drops the
+    // record (and counts it) rather than stalling the loop.
+    void record(uint64_t timestamp_ns, TraceTransport transport, uint32_t client, const ParsedCommand& cmd,
+                std::string_view line) {
+        if (fd_ < 0) return;
+        bool rebuildable =
+            (cmd.op == OP_ADD || cmd.op == OP_DELIVER) && cmd.id >= 0 && cmd.wait_ms == 0 && cmd.request_tag < 0;
+        std::string_view text = rebuildable ? std::string_view() : line.substr(0, UINT16_MAX);
+
+        TraceRecord rec{};
+        rec.timestamp_ns = timestamp_ns;
+        rec.client = client;
+        rec.transport = transport;
+        rec.opcode = cmd.op;
+        rec.id = cmd.id;
+        rec.count = cmd.count;
+        rec.text_len = (uint16_t)text.size();
+
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        size_t need = sizeof(rec) + text.size();
+        if (head + need - cached_tail_ > ring_.size()) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head + need - cached_tail_ > ring_.size()) {
+                ++dropped_;
+                return;
+            }
+        }
+        copy_in(head, &rec, sizeof(rec));
+        copy_in(head + sizeof(rec), text.data(), text.size());
+        head_.store(head + need, std::memory_order_release);
+    }
+
+    void record_text(TraceTransport transport, uint32_t client, std::string_view line) {
+        ParsedCommand cmd{};
+        cmd.op = OP_OTHER;
+        cmd.id = -1;
+        record(stamp(), transport, client, cmd, line);
+    }
+
+    void close() {
+        if (fd_ < 0) return;
+        stop_.store(true, std::memory_order_release);
+        if (thread_.joinable()) thread_.join();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+private:
+    void copy_in(uint64_t pos, const void* src, size_t len) {
+        size_t at = pos & mask_;
+        size_t first = std::min(len, ring_.size() - at);
+        std::memcpy(ring_.data() + at, src, first);
+        std::memcpy(ring_.data(), static_cast<const char*>(src) + first, len - first);
+    }
+
+    // Consumer: the ring already holds the file's byte stream, so it is written as-is.
+    void run() {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            uint64_t head = head_.load(std::memory_order_acquire);
+            if (head == tail) {
+                if (stop_.load(std::memory_order_acquire) && head_.load(std::memory_order_acquire) == tail) break;
+                timespec nap{0, 1000000};
+                nanosleep(&nap, nullptr);
+                continue;
+            }
+            while (tail < head) {
+                size_t at = tail & mask_;
+                size_t len = std::min<uint64_t>(head - tail, ring_.size() - at);
+                ssize_t written = ::write(fd_, ring_.data() + at, len);
+                if (written <= 0) {
+                    tail = head;  // disk trouble: discard rather than block the producer forever
+                    break;
+                }
+                tail += written;
+            }
+            tail_.store(tail, std::memory_order_release);
+        }
+    }
+
+    int fd_ = -1;
+    std::vector<char> ring_;
+    size_t mask_ = 0;
+    uint64_t start_ns_ = 0;
+    uint64_t cached_tail_ = 0;
+    uint64_t dropped_ = 0;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+// Rebuilds the command line a record stands for (without the trailing newline).
+inline std::string trace_command_text(const TraceRecord& rec, const char* text) {
+    if (rec.text_len > 0 || rec.id < 0) return std::string(text, rec.text_len);
+    if (rec.opcode == OP_ADD && rec.id < ATOM_COUNT) {
+        return std::string("ADD ") + ATOM_NAMES[rec.id] + " " + std::to_string(rec.count);
+    }
+    if (rec.opcode == OP_DELIVER && rec.id < MOL_COUNT) {
+        return std::string("DELIVER ") + MOLECULE_NAMES[rec.id] + " " + std::to_string(rec.count);
+    }
+    return std::string(text, rec.text_len);
+}
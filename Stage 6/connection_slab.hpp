@@ -0,0 +1,116 @@
+// File: connection_slab.hpp
+// Description: Slot map of compact stream-connection records with O(1) insert, lookup by fd
+//              and remove. Slots live in fixed pages so pointers stay valid while it grows.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+enum ConnKind : uint8_t { CONN_TCP, CONN_UDS_STREAM, CONN_UDS_SEQPACKET };
+
+// Bytes of an unfinished line kept inside the record; longer leftovers move to a pooled buffer.
+constexpr size_t CONN_INLINE_BYTES = 40;
+
+enum ConnFlags : uint8_t {
+    CONN_ACK_MODE = 1 << 0,   // client asked for cumulative "ACK <seq>" replies
+    CONN_ACK_DIRTY = 1 << 1,  // seq moved since the last ack was sent
+    CONN_PIPED = 1 << 2,      // read by a --pipeline I/O thread, not the event loop
+};
+
+struct Connection {
+    int fd;
+    uint32_t generation;      // unique per connection (slab-wide serial); trace client id
+    int64_t last_activity_ms; // last input, for --idle-timeout
+    char* overflow;           // pooled buffer holding pending input, or nullptr
+    uint32_t next_free;       // free-list link while the slot is unused
+    uint32_t seq;             // command lines applied on this connection
+    uint16_t pending_len;
+    uint8_t kind;
+    bool live;
+    uint8_t flags;            // ConnFlags
+    uint8_t io_thread;        // owning pipeline I/O thread when CONN_PIPED
+    char inline_buf[CONN_INLINE_BYTES];
+};
+static_assert(sizeof(Connection) == 80, "an idle connection costs one 80-byte record");
+
+class ConnectionSlab {
+public:
+    static constexpr uint32_t PAGE_SLOTS = 1024;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    Connection* insert(int fd, ConnKind kind, int64_t now_ms) {
+        if (free_head_ == NONE) grow();
+        uint32_t index = free_head_;
+        Connection& c = slot(index);
+        free_head_ = c.next_free;
+
+        std::memset(&c, 0, sizeof(c));
+        c.fd = fd;
+        c.generation = ++next_generation_;
+        c.last_activity_ms = now_ms;
+        c.next_free = NONE;
+        c.kind = kind;
+        c.live = true;
+
+        if ((size_t)fd >= by_fd_.size()) by_fd_.resize(fd + 1, NONE);
+        by_fd_[fd] = index;
+        ++live_;
+        return &c;
+    }
+
+    void remove(Connection* c) {
+        uint32_t index = by_fd_[c->fd];
+        by_fd_[c->fd] = NONE;
+        c->live = false;
+        c->fd = -1;
+        c->next_free = free_head_;
+        free_head_ = index;
+        --live_;
+    }
+
+    Connection* find_fd(int fd) {
+        if (fd < 0 || (size_t)fd >= by_fd_.size() || by_fd_[fd] == NONE) return nullptr;
+        return &slot(by_fd_[fd]);
+    }
+
+    // Visits live connections; fn may remove the connection it is given.
+    template <typename Fn>
+    void for_each(Fn fn) {
+        for (uint32_t i = 0; i < capacity_; ++i) {
+            Connection& c = slot(i);
+            if (c.live) fn(c);
+        }
+    }
+
+    size_t size() const { return live_; }
+    size_t capacity() const { return capacity_; }
+    size_t memory_bytes() const {
+        return pages_.size() * PAGE_SLOTS * sizeof(Connection) + by_fd_.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    Connection& slot(uint32_t index) { return pages_[index / PAGE_SLOTS][index % PAGE_SLOTS]; }
+
+    void grow() {
+        pages_.emplace_back(new Connection[PAGE_SLOTS]());
+        uint32_t base = capacity_;
+        capacity_ += PAGE_SLOTS;
+        for (uint32_t i = PAGE_SLOTS; i-- > 0;) {
+            Connection& c = slot(base + i);
+            c.fd = -1;
+            c.next_free = free_head_;
+            free_head_ = base + i;
+        }
+    }
+
+    std::vector<std::unique_ptr<Connection[]>> pages_;
+    std::vector<uint32_t> by_fd_;
+    uint32_t free_head_ = NONE;
+    uint32_t capacity_ = 0;
+    uint32_t next_generation_ = 0;
+    size_t live_ = 0;
+};
@@ -7,7 +7,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <cerrno>
+#include <netinet/tcp.h>
 #include <map>
 #include <vector>
 #include <algorithm>
@@ -20,16 +22,45 @@
 #include <fcntl.h>
 #include <sys/file.h>
 #include <fstream>
+#include <string_view>
+#include "command_parser.hpp"
+#include "arena.hpp"
+#include "connection_slab.hpp"
+#include "command_trace.hpp"
+#include "timer_queue.hpp"
+#include "inventory_snapshot.hpp"
+#include "stream_pipeline.hpp"
+#include "shm_ring.hpp"
+#include <sys/wait.h>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <poll.h>
+#include <netdb.h>
+#include <climits>
+#include <pthread.h>
+#include <sched.h>
+#include <array>
+#include <sys/eventfd.h>
 #define BUFFER_SIZE 1024
+#define CONN_BUFFER_SIZE 16384
 
 void save_inventory_to_file(const std::string& filepath);
 void load_inventory_from_file(const std::string& filepath);
+void wake_waiting_orders(unsigned added_atoms);
+void return_leases();
+void flush_mutation_log();
+void reap_idle_connections();
 
-// === UDS globals ===
-int uds_stream_sock = -1, uds_dgram_sock = -1;
-std::string uds_stream_path, uds_dgram_path;
+// === Listener globals ===
+int tcp_port = -1, udp_port = -1;
+int tcp_sock = -1, udp_sock = -1;
+int uds_stream_sock = -1, uds_dgram_sock = -1, uds_seqpacket_sock = -1;
+std::string uds_stream_path, uds_dgram_path, uds_seqpacket_path;
 std::string save_file_path;
 
+// Only the event-loop thread touches atoms and molecules, so there is no lock to shard away;
+// per-atom shard threads fed by SPSC queues were benchmarked and only added queue hops.
 std::map<std::string, int> atoms = {
     {"HYDROGEN", 0},
     {"OXYGEN", 0},
@@ -43,9 +74,115 @@ std::map<std::string, int> molecules = {
     {"GLUCOSE", 0}
 };
 
-std::vector<int> tcp_clients;
+// Bumped by every change to atoms or molecules; SUBSCRIBE and INVENTORY replies carry it.
+uint64_t inventory_version = 1;
+
+// TCP and UDS stream clients; each record keeps a short unfinished line inline.
+ConnectionSlab connections;
+int epoll_fd = -1;
 int timeout_seconds = 0;
 
+// Listener tuning: a reconnect storm after a restart needs a deep accept queue.
+int listen_backlog = SOMAXCONN;
+int defer_accept_seconds = 1;
+
+// Per-request temporaries live in frame_arena, which main() resets every loop iteration.
+// A connection whose unfinished line outgrows its inline bytes parks it in a pooled buffer.
+Arena frame_arena;
+BufferPool conn_buffers(CONN_BUFFER_SIZE);
+
+// --trace <file>: every inbound command, written off-thread.
+TraceWriter trace;
+
+// --pipeline N: stream connections are read and parsed by N I/O threads (stream_pipeline.hpp);
+// the event loop stays the only thread that touches the inventory.
+StreamPipeline pipeline;
+int pipeline_threads = 0;
+
+// -m <name>: local clients talk through shared-memory rings in /dev/shm (shm_ring.hpp).
+ShmServer shm;
+std::string shm_name;
+bool shm_busy_poll = false;
+uint32_t shm_generation[SHM_CHANNELS];
+uint32_t shm_seq[SHM_CHANNELS];  // ADD lines applied per channel generation
+
+// --busy-poll USEC: after work the loop keeps polling (epoll_wait with a zero timeout, and the
+// shared-memory rings) for USEC microseconds before it blocks again; client-facing inet
+// sockets get SO_BUSY_POLL. --cpus pins the loop to the first CPU and the pipeline I/O
+// threads to the rest; forked snapshot children get the original mask back.
+int busy_poll_us = 0;
+std::vector<int> loop_cpus;
+cpu_set_t startup_cpus;
+
+// Deadlines for the event loop; epoll_wait sleeps until the earliest one.
+enum TimerKind : uint8_t {
+    TIMER_WAITING_ORDER,
+    TIMER_RESERVATION,
+    TIMER_FEED_TICK,
+    TIMER_SNAPSHOT,
+    TIMER_SNAPSHOT_POLL,
+    TIMER_PEER_GOSSIP,
+    TIMER_FORWARD,
+    TIMER_LEASE_RETRY,
+    TIMER_IDLE_SWEEP,
+    TIMER_TAKEOVER,
+};
+TimerQueue timers;
+
+// DELIVER ... WAIT <ms>: an order the atoms cannot cover yet parks in its molecule's FIFO
+// until an ADD makes it possible or its deadline passes. Queues hold order ids; an id that is
+// no longer in waiting_orders (timed out) is skipped when it reaches the front.
+struct WaitingOrder {
+    const char* tag;
+    int sock;
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    int8_t mol;
+    int32_t count;
+    int32_t request_tag;
+};
+std::unordered_map<uint64_t, WaitingOrder> waiting_orders;
+std::deque<uint64_t> waiting_by_molecule[MOL_COUNT];
+uint64_t next_order_id = 1;
+
+// RESERVE <molecule> <n> TTL <ms> moves the recipe's atoms out of the free counts in atoms
+// into reserved_atoms until COMMIT turns them into molecules or CANCEL / the TTL returns them.
+// The save file holds free + reserved, so only COMMIT changes what is persisted.
+struct Reservation {
+    int8_t mol;
+    int32_t count;
+};
+std::unordered_map<uint64_t, Reservation> reservations;
+int reserved_atoms[ATOM_COUNT];
+uint64_t next_reservation_id = 1;
+
+// Wakeup index: for each atom, the molecule queues an ADD of it can unblock.
+unsigned molecules_using_atom[ATOM_COUNT];
+
+void build_wakeup_index() {
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        molecules_using_atom[a] = 0;
+        for (int m = 0; m < MOL_COUNT; ++m) {
+            if (MOLECULE_RECIPES[m][a] > 0) molecules_using_atom[a] |= 1u << m;
+        }
+    }
+}
+
+// Per-request logging; --quiet swaps it for a null stream so bulk loads are not bound by stdout.
+bool quiet = false;
+std::ostream null_log(nullptr);
+std::ostream& req_log() { return quiet ? null_log : std::cout; }
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void save_inventory_to_file(const std::string& path) {
     int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (fd == -1) {
@@ -55,161 +192,1884 @@ void save_inventory_to_file(const std::string& path) {
     flock(fd, LOCK_EX);
     std::ofstream out(path);
     for (const auto& kv : atoms) {
-        out << kv.first << " " << kv.second << "\n";
+        int id = atom_id(kv.first.data(), kv.first.size());
+        out << kv.first << " " << kv.second + (id >= 0 ? reserved_atoms[id] : 0) << "\n";
+    }
+    out.close();
+    flock(fd, LOCK_UN);
+    close(fd);
+    req_log() << "[SAVE] Inventory saved to " << path << " by PID " << getpid() << std::endl;
+}
+
+void print_atoms() {
+    req_log() << "Current atom counts: ";
+    for (const auto& kv : atoms)
+        req_log() << kv.first << ": " << kv.second << "  ";
+    req_log() << std::endl;
+}
+
+
+// SIGINT and SIGALRM (the -t inactivity timeout) only note the signal and wake epoll_wait
+// through stop_event_fd; the loop then leaves and shuts down the normal way.
+volatile sig_atomic_t stop_signal = 0;
+int stop_event_fd = -1;
+
+void handle_stop_signal(int sig) {
+    int saved_errno = errno;
+    stop_signal = sig;
+    uint64_t one = 1;
+    if (write(stop_event_fd, &one, sizeof(one)) < 0) {}
+    errno = saved_errno;
+}
+
+void reset_alarm() {
+    if (timeout_seconds > 0) alarm(timeout_seconds);
+}
+
+void load_inventory_from_file(const std::string& filepath) {
+    std::ifstream in(filepath);
+    if (!in) return;
+    std::string key;
+    int value;
+    while (in >> key >> value) {
+        if (atoms.count(key)) atoms[key] = value;
+        else if (molecules.count(key)) molecules[key] = value;
+    }
+    std::cout << "[INFO] Inventory loaded from: " << filepath << std::endl;
+}
+
+// Stream connections whose ack sequence moved during this loop iteration.
+std::vector<int> ack_dirty;
+
+constexpr size_t MAX_WORDS = 32;
+
+// Splits a slow-path line into at most MAX_WORDS whitespace-separated words.
+size_t split_words(std::string_view line, std::string_view* words) {
+    size_t n = 0;
+    for (size_t pos = 0; n < MAX_WORDS;) {
+        pos = line.find_first_not_of(" \t\r\n", pos);
+        if (pos == std::string_view::npos) break;
+        size_t end = std::min(line.find_first_of(" \t\r\n", pos), line.size());
+        words[n++] = line.substr(pos, end - pos);
+        pos = end;
+    }
+    return n;
+}
+
+// Returns the decimal value of word, or -1 if it is not a number in [0, max].
+long long parse_number(std::string_view word, long long max) {
+    if (word.empty() || word.size() > 18 || word.find_first_not_of("0123456789") != std::string_view::npos) return -1;
+    long long v = 0;
+    for (char c : word) v = v * 10 + (c - '0');
+    return v <= max ? v : -1;
+}
+
+// words[first..last) joined by single spaces, in frame_arena (multi-word molecule names).
+std::string_view join_words(const std::string_view* words, size_t first, size_t last) {
+    size_t len = last - first - 1;
+    for (size_t i = first; i < last; ++i) len += words[i].size();
+    char* out = frame_arena.alloc_array<char>(len + 1);
+    char* p = out;
+    for (size_t i = first; i < last; ++i) {
+        if (i > first) *p++ = ' ';
+        std::memcpy(p, words[i].data(), words[i].size());
+        p += words[i].size();
+    }
+    *p = '\0';
+    return std::string_view(out, len);
+}
+
+// WATCH <atom|molecule|drink> BELOW|ABOVE <n> on a stream connection. The bar pushes
+// "ALERT <key> BELOW|ABOVE <n> <value>" when the level crosses into the condition; nothing is
+// sent while it stays there. Watches are indexed per key by threshold, so a level change from
+// old to new only touches the watches whose threshold lies between the two.
+struct Watch {
+    int fd;
+    int key;
+    bool below;
+    std::multimap<int, uint64_t>::iterator slot;
+};
+std::unordered_map<uint64_t, Watch> watches;
+std::unordered_map<int, std::vector<uint64_t>> watches_by_fd;
+std::multimap<int, uint64_t> watch_below[STOCK_KEY_COUNT], watch_above[STOCK_KEY_COUNT];
+int watched_level[STOCK_KEY_COUNT];
+uint64_t next_watch_id = 1;
+
+// Current level of a stock key; a drink's level is how many could be mixed right now.
+int stock_level(int key) {
+    if (key < ATOM_COUNT) return atoms[ATOM_NAMES[key]];
+    if (key < ATOM_COUNT + MOL_COUNT) return molecules[MOLECULE_NAMES[key - ATOM_COUNT]];
+    const MoleculeId* recipe = DRINK_RECIPES[key - ATOM_COUNT - MOL_COUNT];
+    int level = INT_MAX;
+    for (int i = 0; i < 3; ++i) level = std::min(level, molecules[MOLECULE_NAMES[recipe[i]]]);
+    return level;
+}
+
+// Everything the loop writes to one of its own connections (replies, ACKs, ALERTs, feed
+// messages) goes out in order through that connection's queue, so nothing lands in the middle
+// of a partly written message. What the socket does not take waits for EPOLLOUT; a client
+// that lets more than CONN_OUTBUF_LIMIT pile up is shut down and the EOF path closes it.
+// SEQPACKET messages are kept whole, with their sizes in sizes.
+constexpr size_t CONN_OUTBUF_LIMIT = 1 << 20;
+
+struct OutputQueue {
+    std::string data;
+    std::deque<uint32_t> sizes;  // SEQPACKET only
+    bool writing = false;        // EPOLLOUT is armed
+};
+std::unordered_map<int, OutputQueue> output_queues;
+
+void flush_output(Connection& conn, OutputQueue& out) {
+    bool messages = conn.kind == CONN_UDS_SEQPACKET;
+    size_t sent = 0;
+    while (sent < out.data.size()) {
+        size_t len = messages ? out.sizes.front() : out.data.size() - sent;
+        ssize_t n = send(conn.fd, out.data.data() + sent, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) {  // the read side sees the error and closes
+            sent = out.data.size();
+            out.sizes.clear();
+            break;
+        }
+        sent += n;
+        if (messages) out.sizes.pop_front();
+    }
+    out.data.erase(0, sent);
+    if (out.data.size() > CONN_OUTBUF_LIMIT) {
+        std::cerr << "[WARN] FD=" << conn.fd << " is not reading its replies, closing" << std::endl;
+        shutdown(conn.fd, SHUT_RDWR);
+        out.data.clear();
+        out.sizes.clear();
+    }
+    bool want = !out.data.empty();
+    if (want != out.writing) {
+        out.writing = want;
+        epoll_event ev{};
+        ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.fd = conn.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+    }
+}
+
+void queue_output(Connection& conn, std::string_view text) {
+    OutputQueue& out = output_queues[conn.fd];
+    bool idle = out.data.empty();
+    out.data.append(text.data(), text.size());
+    if (conn.kind == CONN_UDS_SEQPACKET) out.sizes.push_back((uint32_t)text.size());
+    if (idle) flush_output(conn, out);
+}
+
+// True while some of what was queued for fd has not been written yet.
+bool output_pending(int fd) {
+    auto out = output_queues.find(fd);
+    return out != output_queues.end() && !out->second.data.empty();
+}
+
+// A --pipeline connection is only written by its I/O thread, which queues replies behind
+// the acks it already owes.
+void send_line(int fd, std::string_view line) {
+    Connection* conn = connections.find_fd(fd);
+    if (!conn) return;
+    if (conn->flags & CONN_PIPED) pipeline.post_text(conn->io_thread, fd, line);
+    else queue_output(*conn, line);
+}
+
+uint64_t add_watch(int fd, int key, bool below, int threshold) {
+    if (watches.empty()) {
+        for (int k = 0; k < STOCK_KEY_COUNT; ++k) watched_level[k] = stock_level(k);
+    }
+    uint64_t id = next_watch_id++;
+    auto slot = (below ? watch_below : watch_above)[key].emplace(threshold, id);
+    watches[id] = Watch{fd, key, below, slot};
+    watches_by_fd[fd].push_back(id);
+    return id;
+}
+
+void remove_watch(uint64_t id) {
+    auto it = watches.find(id);
+    if (it == watches.end()) return;
+    (it->second.below ? watch_below : watch_above)[it->second.key].erase(it->second.slot);
+    watches.erase(it);
+}
+
+void remove_connection_watches(int fd) {
+    auto it = watches_by_fd.find(fd);
+    if (it == watches_by_fd.end()) return;
+    for (uint64_t id : it->second) remove_watch(id);
+    watches_by_fd.erase(it);
+}
+
+// Runs once per loop iteration, so a burst of ADDs and DELIVERs is compared as one change.
+void notify_watches() {
+    if (watches.empty()) return;
+    for (int key = 0; key < STOCK_KEY_COUNT; ++key) {
+        int before = watched_level[key], now = stock_level(key);
+        if (now == before) continue;
+        watched_level[key] = now;
+        // BELOW n fires when now < n <= before; ABOVE n when before <= n < now.
+        auto first = now < before ? watch_below[key].upper_bound(now) : watch_above[key].lower_bound(before);
+        auto last = now < before ? watch_below[key].upper_bound(before) : watch_above[key].lower_bound(now);
+        for (auto it = first; it != last; ++it) {
+            const Watch& watch = watches[it->second];
+            send_line(watch.fd, frame_arena.format("ALERT %s %s %d %d\n", stock_key_name(key),
+                                                   watch.below ? "BELOW" : "ABOVE", it->first, now));
+            req_log() << "[WATCH] " << stock_key_name(key) << (watch.below ? " below " : " above ") << it->first
+                      << " (now " << now << "), FD=" << watch.fd << std::endl;
+        }
+    }
+}
+
+// Renders "<verb> <version> KEY=level;KEY=level;...\n" for the stock keys in mask.
+std::string_view format_levels(const char* verb, uint64_t version, const int* levels, unsigned mask) {
+    size_t cap = std::strlen(verb) + 24;  // " <version> ", the newline and the NUL
+    for (int key = 0; key < STOCK_KEY_COUNT; ++key) {
+        if (mask & (1u << key)) cap += std::strlen(stock_key_name(key)) + 13;  // "=<level>;"
+    }
+    char* out = frame_arena.alloc_array<char>(cap);
+    size_t len = std::snprintf(out, cap, "%s %llu ", verb, (unsigned long long)version);
+    for (int key = 0; key < STOCK_KEY_COUNT; ++key) {
+        if (mask & (1u << key)) len += std::snprintf(out + len, cap - len, "%s=%d;", stock_key_name(key), levels[key]);
+    }
+    out[len++] = '\n';
+    out[len] = '\0';
+    return std::string_view(out, len);
+}
+
+// INVENTORY [IF-NEWER <version>] on any transport: "INVENTORY <version> KEY=level;...\n", or
+// "NOT-MODIFIED <version>\n" when the caller already has that version. Only an exact match
+// counts: without --snapshot the version starts at 1 again after a restart, so a caller holding
+// a higher one has stale levels. The full reply is built once per version, so pollers only pay
+// for a compare and a send.
+std::string inventory_reply_cache;
+uint64_t inventory_reply_version = 0;
+
+std::string_view handle_inventory_query(const std::string_view* words, size_t n) {
+    if (n < 1 || words[0] != "INVENTORY") return std::string_view();
+    if (n == 3 && words[1] == "IF-NEWER") {
+        long long known = parse_number(words[2], LLONG_MAX);
+        if (known >= 0 && (uint64_t)known == inventory_version) {
+            return frame_arena.format("NOT-MODIFIED %llu\n", (unsigned long long)inventory_version);
+        }
+    } else if (n != 1) {
+        return "FAILED\n";
+    }
+    if (inventory_reply_version != inventory_version) {
+        int levels[STOCK_KEY_COUNT];
+        for (int key = 0; key < STOCK_KEY_COUNT; ++key) levels[key] = stock_level(key);
+        inventory_reply_cache = format_levels("INVENTORY", inventory_version, levels, (1u << STOCK_KEY_COUNT) - 1);
+        inventory_reply_version = inventory_version;
+    }
+    return inventory_reply_cache;
+}
+
+// SUBSCRIBE on a stream connection: a SNAPSHOT line, then at most one DELTA line per feed tick
+// carrying only the keys that changed since the last one. Feed messages share the connection's
+// output queue; while it still holds unsent bytes at a tick, the deltas are dropped and the
+// subscriber gets a fresh SNAPSHOT once it drains.
+constexpr int FEED_TICK_MS = 10;
+
+struct Subscriber {
+    bool resync = false;
+};
+std::unordered_map<int, Subscriber> subscribers;
+int feed_level[STOCK_KEY_COUNT];
+uint64_t feed_version = 0;
+bool feed_tick_scheduled = false;
+
+void subscribe(int fd) {
+    if (subscribers.empty()) {
+        for (int key = 0; key < STOCK_KEY_COUNT; ++key) feed_level[key] = stock_level(key);
+        feed_version = inventory_version;
+    }
+    Subscriber& sub = subscribers[fd];
+    sub.resync = false;
+    send_line(fd, format_levels("SNAPSHOT", feed_version, feed_level, (1u << STOCK_KEY_COUNT) - 1));
+    if (!feed_tick_scheduled) {
+        timers.schedule(now_ms() + FEED_TICK_MS, TIMER_FEED_TICK, 0);
+        feed_tick_scheduled = true;
+    }
+}
+
+void feed_tick() {
+    feed_tick_scheduled = false;
+    if (subscribers.empty()) return;
+
+    std::string_view delta;
+    if (feed_version != inventory_version) {
+        unsigned changed = 0;
+        for (int key = 0; key < STOCK_KEY_COUNT; ++key) {
+            int level = stock_level(key);
+            if (level != feed_level[key]) changed |= 1u << key;
+            feed_level[key] = level;
+        }
+        feed_version = inventory_version;
+        if (changed) delta = format_levels("DELTA", feed_version, feed_level, changed);
+    }
+
+    for (auto& [fd, sub] : subscribers) {
+        if (output_pending(fd)) {  // a --pipeline I/O thread buffers everything itself
+            sub.resync = true;
+            continue;
+        }
+        if (sub.resync) {
+            sub.resync = false;
+            send_line(fd, format_levels("SNAPSHOT", feed_version, feed_level, (1u << STOCK_KEY_COUNT) - 1));
+            req_log() << "[FEED] Resynced slow subscriber FD=" << fd << std::endl;
+        } else if (!delta.empty()) {
+            send_line(fd, delta);
+        }
+    }
+    timers.schedule(now_ms() + FEED_TICK_MS, TIMER_FEED_TICK, 0);
+    feed_tick_scheduled = true;
+}
+
+// Slow path for stream lines that are not ADD. Returns false if the line is not a command.
+// LEASE <atom> <n> / RETURN <atom> <n> on a stream connection come from edge bars started
+// with --lease-from. Leased atoms leave the free stock here until they are returned, so this
+// bar's atoms plus every edge's outstanding lease always add up to what was ADDed. A
+// connection can only return what it holds; when it closes, its lease stays counted out
+// (the edge may have served it).
+long long leased_out[ATOM_COUNT];
+std::unordered_map<int, std::array<long long, ATOM_COUNT>> leases_by_fd;
+
+void handle_lease_command(int fd, const std::string_view* words) {
+    int atom = stock_key_id(words[1].data(), words[1].size());
+    long long amount = parse_number(words[2], INT_MAX);
+    bool lease = words[0] == "LEASE";
+    long long* held = atom >= 0 && atom < ATOM_COUNT ? &leases_by_fd[fd][atom] : nullptr;
+    if (!held || amount < 0 || (!lease && amount > *held)) {
+        send_line(fd, "FAILED\n");
+        req_log() << "[LEASE] FD=" << fd << " rejected: " << words[0] << " " << words[1] << " " << words[2] << std::endl;
+        return;
+    }
+    int& level = atoms[ATOM_NAMES[atom]];
+    if (lease) {
+        amount = std::min<long long>(amount, level);
+        level -= amount;
+        leased_out[atom] += amount;
+        *held += amount;
+    } else {
+        level += amount;
+        leased_out[atom] -= amount;
+        *held -= amount;
+    }
+    if (amount > 0) {
+        ++inventory_version;
+        if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
+        if (!lease) wake_waiting_orders(1u << atom);
+    }
+    send_line(fd, frame_arena.format("%s %s %lld\n", lease ? "LEASED" : "RETURNED", ATOM_NAMES[atom], amount));
+    req_log() << "[LEASE] FD=" << fd << (lease ? " leased " : " returned ") << amount << " " << ATOM_NAMES[atom]
+              << " (" << leased_out[atom] << " out)" << std::endl;
+}
+
+bool handle_stream_control(Connection* conn, std::string_view line) {
+    if (conn && (line == "ACK ON" || line == "ACK OFF")) {
+        if (line == "ACK ON") conn->flags |= CONN_ACK_MODE;
+        else conn->flags &= ~CONN_ACK_MODE;
+        return true;
+    }
+
+    std::string_view words[MAX_WORDS];
+    size_t n = conn ? split_words(line, words) : 0;
+    if (n >= 4 && words[0] == "WATCH" && (words[n - 2] == "BELOW" || words[n - 2] == "ABOVE")) {
+        std::string_view name = join_words(words, 1, n - 2);
+        int key = stock_key_id(name.data(), name.size());
+        long long threshold = parse_number(words[n - 1], INT_MAX);
+        if (key < 0 || threshold < 0) {
+            send_line(conn->fd, "FAILED\n");
+            return true;
+        }
+        uint64_t id = add_watch(conn->fd, key, words[n - 2] == "BELOW", (int)threshold);
+        send_line(conn->fd, frame_arena.format("WATCHING %llu %d\n", (unsigned long long)id, stock_level(key)));
+        req_log() << "[WATCH] FD=" << conn->fd << " watches " << line << " as #" << id << std::endl;
+        return true;
+    }
+    std::string_view inventory = handle_inventory_query(words, n);
+    if (!inventory.empty()) {
+        send_line(conn->fd, inventory);
+        return true;
+    }
+    if (n == 1 && (words[0] == "SUBSCRIBE" || words[0] == "UNSUBSCRIBE")) {
+        if (words[0] == "SUBSCRIBE") subscribe(conn->fd);
+        else subscribers.erase(conn->fd);
+        req_log() << "[FEED] FD=" << conn->fd << (words[0] == "SUBSCRIBE" ? " subscribed" : " unsubscribed") << std::endl;
+        return true;
+    }
+    if (n == 2 && words[0] == "UNWATCH") {
+        long long id = parse_number(words[1], LLONG_MAX);
+        auto it = id < 0 ? watches.end() : watches.find((uint64_t)id);
+        if (it == watches.end() || it->second.fd != conn->fd) {
+            send_line(conn->fd, "FAILED\n");
+            return true;
+        }
+        remove_watch((uint64_t)id);
+        std::vector<uint64_t>& mine = watches_by_fd[conn->fd];
+        mine.erase(std::remove(mine.begin(), mine.end(), (uint64_t)id), mine.end());
+        send_line(conn->fd, "OK\n");
+        return true;
+    }
+    if (n == 3 && (words[0] == "LEASE" || words[0] == "RETURN")) {
+        handle_lease_command(conn->fd, words);
+        return true;
+    }
+    return false;
+}
+
+TraceTransport trace_transport(const Connection& conn) {
+    if (conn.kind == CONN_UDS_SEQPACKET) return TRACE_SEQPACKET;
+    return conn.kind == CONN_TCP ? TRACE_TCP : TRACE_UDS_STREAM;
+}
+
+// Applies every complete ADD line in buf and returns the number of bytes used; a trailing
+// partial line is left for the caller unless final is set. The inventory file is rewritten
+// once per batch, and conn (if any) gets a single cumulative ack at the end of the iteration.
+size_t apply_add_batch(const char* tag, TraceTransport transport, uint32_t client, const char* buf, size_t len,
+                       bool final, Connection* conn) {
+    size_t max_cmds = len / 2 + 1;
+    ParsedCommand* cmds = frame_arena.alloc_array<ParsedCommand>(max_cmds);
+    size_t consumed = 0;
+    size_t n = parse_command_batch(buf, len, cmds, max_cmds, final, &consumed);
+    if (n == 0) return consumed;
+
+    bool changed = false;
+    unsigned added_atoms = 0;
+    uint32_t applied = 0;
+    uint64_t trace_ts = trace.enabled() ? trace.stamp() : 0;
+    for (size_t i = 0; i < n; ++i) {
+        const ParsedCommand& cmd = cmds[i];
+        if (trace.enabled()) trace.record(trace_ts, transport, client, cmd, std::string_view(buf + cmd.offset, cmd.length));
+        if (cmd.op == OP_OTHER && handle_stream_control(conn, std::string_view(buf + cmd.offset, cmd.length))) {
+            continue;
+        }
+        ++applied;
+        if (cmd.op != OP_ADD) {
+            req_log() << tag << " Invalid command\n";
+        } else if (cmd.id < 0) {
+            req_log() << tag << " Invalid atom type: " << std::string_view(buf + cmd.name_offset, cmd.name_length) << std::endl;
+        } else {
+            atoms[ATOM_NAMES[cmd.id]] += cmd.count;
+            req_log() << tag << " Added " << cmd.count << " of " << ATOM_NAMES[cmd.id] << std::endl;
+            changed = true;
+            added_atoms |= 1u << cmd.id;
+            ++inventory_version;
+        }
+    }
+    if (changed && !save_file_path.empty()) save_inventory_to_file(save_file_path);
+    if (added_atoms) wake_waiting_orders(added_atoms);
+
+    if (conn && applied > 0) {
+        conn->seq += applied;
+        if ((conn->flags & (CONN_ACK_MODE | CONN_ACK_DIRTY)) == CONN_ACK_MODE) {
+            conn->flags |= CONN_ACK_DIRTY;
+            ack_dirty.push_back(conn->fd);
+        }
+    }
+
+    if (applied > 0) print_atoms();
+    return consumed;
+}
+
+// Sends one "ACK <seq>" per connection that applied commands this iteration. Acks are
+// cumulative, so one that cannot be written right now is simply superseded by the next.
+void flush_acks() {
+    for (int fd : ack_dirty) {
+        Connection* conn = connections.find_fd(fd);
+        if (!conn || !(conn->flags & CONN_ACK_DIRTY)) continue;
+        conn->flags &= ~CONN_ACK_DIRTY;
+        if (conn->flags & CONN_PIPED) {
+            pipeline.post_ack(conn->io_thread, conn->fd, conn->seq);
+            continue;
+        }
+        queue_output(*conn, frame_arena.format("ACK %u\n", conn->seq));
+    }
+    ack_dirty.clear();
+    if (pipeline.enabled()) pipeline.flush_posts();
+}
+
+// Reads from a stream connection and applies the complete lines. Returns false once the
+// peer has closed (any unterminated last line is applied then).
+bool read_add_stream(const char* tag, Connection& conn) {
+    char* buf = conn.overflow;
+    if (!buf) {
+        buf = conn_buffers.acquire();
+        std::memcpy(buf, conn.inline_buf, conn.pending_len);
+    }
+    size_t have = conn.pending_len;
+    ssize_t len = recv(conn.fd, buf + have, conn_buffers.buffer_size() - have, 0);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        if (!conn.overflow) conn_buffers.release(buf);
+        return true;
+    }
+    if (len <= 0) {
+        if (have > 0) apply_add_batch(tag, trace_transport(conn), conn.generation, buf, have, true, &conn);
+        conn_buffers.release(buf);
+        conn.overflow = nullptr;
+        conn.pending_len = 0;
+        return false;
+    }
+
+    reset_alarm();
+    conn.last_activity_ms = now_ms();
+
+    size_t total = have + len;
+    size_t used = apply_add_batch(tag, trace_transport(conn), conn.generation, buf, total, false, &conn);
+    if (used == 0 && total == conn_buffers.buffer_size()) {
+        used = apply_add_batch(tag, trace_transport(conn), conn.generation, buf, total, true, &conn);  // one line longer than the buffer
+    }
+    size_t rest = total - used;
+    if (rest <= CONN_INLINE_BYTES) {
+        std::memcpy(conn.inline_buf, buf + total - rest, rest);
+        conn_buffers.release(buf);
+        conn.overflow = nullptr;
+    } else {
+        std::memmove(buf, buf + total - rest, rest);
+        conn.overflow = buf;
+    }
+    conn.pending_len = (uint16_t)rest;
+    return true;
+}
+
+// Makes up to count molecules in one step; returns how many the atoms could cover.
+int make_molecules(int mol, int count) {
+    const int* recipe = MOLECULE_RECIPES[mol];
+    int possible = count;
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        if (recipe[a] > 0) possible = std::min(possible, atoms[ATOM_NAMES[a]] / recipe[a]);
+    }
+    if (possible <= 0) return 0;
+
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        atoms[ATOM_NAMES[a]] -= recipe[a] * possible;
+    }
+    molecules[MOLECULE_NAMES[mol]] += possible;
+    ++inventory_version;
+    return possible;
+}
+
+int deliver_molecule(int mol, int count) {
+    int made = make_molecules(mol, count);
+    if (made > 0 && !save_file_path.empty()) save_inventory_to_file(save_file_path);
+    return made;
+}
+
+void park_order(const char* tag, int sock, const sockaddr* addr, socklen_t addrlen, const ParsedCommand& cmd) {
+    uint64_t id = next_order_id++;
+    WaitingOrder& order = waiting_orders[id];
+    order.tag = tag;
+    order.sock = sock;
+    std::memcpy(&order.addr, addr, addrlen);
+    order.addrlen = addrlen;
+    order.mol = cmd.id;
+    order.count = cmd.count;
+    order.request_tag = cmd.request_tag;
+    waiting_by_molecule[cmd.id].push_back(id);
+    timers.schedule(now_ms() + cmd.wait_ms, TIMER_WAITING_ORDER, id);
+}
+
+// Datagram replies wait here until the end of the loop iteration, after the iteration's
+// changes are logged and (with --sync-replication) acknowledged by every standby. Reply text
+// lives in frame_arena or static storage, both valid until then.
+struct PendingReply {
+    int sock;
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    std::string_view text;
+};
+std::vector<PendingReply> reply_outbox;
+
+void queue_reply(int sock, const sockaddr* addr, socklen_t addrlen, std::string_view text) {
+    if (sock < 0) return;  // the SEQPACKET connection it came from is gone
+    reply_outbox.emplace_back();
+    PendingReply& reply = reply_outbox.back();
+    reply.sock = sock;
+    std::memcpy(&reply.addr, addr, addrlen);
+    reply.addrlen = addrlen;
+    reply.text = text;
+}
+
+// Shared-memory replies are held back the same way.
+struct PendingShmReply {
+    size_t channel;
+    uint32_t generation;
+    std::string_view text;
+};
+std::vector<PendingShmReply> shm_outbox;
+
+void flush_replies() {
+    for (const PendingReply& reply : reply_outbox) {
+        if (reply.addrlen == 0) send_line(reply.sock, reply.text);  // SEQPACKET: on the connection's queue
+        else sendto(reply.sock, reply.text.data(), reply.text.size(), 0, (const sockaddr*)&reply.addr, reply.addrlen);
+    }
+    reply_outbox.clear();
+    for (const PendingShmReply& reply : shm_outbox) shm.reply(reply.channel, reply.generation, reply.text);
+    shm_outbox.clear();
+}
+
+// DELIVER ... TAG <n>: the reply ends in " TAG <n>", so a client with several orders in
+// flight can match replies that come back out of order (parked or forwarded ones).
+std::string_view tag_reply(std::string_view reply, int32_t request_tag) {
+    if (request_tag < 0) return reply;
+    return frame_arena.format("%.*s TAG %d", (int)reply.size(), reply.data(), request_tag);
+}
+
+void reply_to_order(const WaitingOrder& order, std::string_view reply) {
+    queue_reply(order.sock, (const sockaddr*)&order.addr, order.addrlen, tag_reply(reply, order.request_tag));
+}
+
+// Drops timed-out ids from the front so the head is always a live order.
+std::deque<uint64_t>& live_queue(int mol) {
+    std::deque<uint64_t>& queue = waiting_by_molecule[mol];
+    while (!queue.empty() && waiting_orders.find(queue.front()) == waiting_orders.end()) queue.pop_front();
+    return queue;
+}
+
+// Serves parked orders after an ADD. Only queues of molecules that use an added atom are
+// looked at; among those, the oldest head goes first, and a queue whose head still cannot be
+// served is done for this pass (orders for one molecule never overtake each other).
+void wake_waiting_orders(unsigned added_atoms) {
+    unsigned candidates = 0;
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        if (added_atoms & (1u << a)) candidates |= molecules_using_atom[a];
+    }
+
+    bool changed = false;
+    while (candidates) {
+        int best = -1;
+        for (int m = 0; m < MOL_COUNT; ++m) {
+            if (!(candidates & (1u << m))) continue;
+            std::deque<uint64_t>& queue = live_queue(m);
+            if (queue.empty()) candidates &= ~(1u << m);
+            else if (best < 0 || queue.front() < waiting_by_molecule[best].front()) best = m;
+        }
+        if (best < 0) break;
+
+        uint64_t id = waiting_by_molecule[best].front();
+        auto it = waiting_orders.find(id);
+        int made = make_molecules(best, it->second.count);
+        if (made == 0) {
+            candidates &= ~(1u << best);
+            continue;
+        }
+        reply_to_order(it->second, frame_arena.format("OK %d", made));
+        req_log() << it->second.tag << " Delivered " << made << " of " << MOLECULE_NAMES[best] << " (waited)" << std::endl;
+        waiting_orders.erase(it);
+        waiting_by_molecule[best].pop_front();
+        changed = true;
+    }
+    if (changed && !save_file_path.empty()) save_inventory_to_file(save_file_path);
+}
+
+void expire_waiting_order(uint64_t id) {
+    auto it = waiting_orders.find(id);
+    if (it == waiting_orders.end()) return;
+    int mol = it->second.mol;
+    reply_to_order(it->second, "FAILED");
+    req_log() << it->second.tag << " FAILED to deliver molecule: " << MOLECULE_NAMES[mol] << " (wait timed out)" << std::endl;
+    waiting_orders.erase(it);
+    live_queue(mol);
+}
+
+// All-or-nothing: either the full count is held or nothing changes.
+std::string_view reserve_molecule(const char* tag, int mol, int count, int ttl_ms) {
+    const int* recipe = MOLECULE_RECIPES[mol];
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        if ((int64_t)recipe[a] * count > atoms[ATOM_NAMES[a]]) {
+            req_log() << tag << " FAILED to reserve " << count << " of " << MOLECULE_NAMES[mol] << std::endl;
+            return "FAILED";
+        }
+    }
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        atoms[ATOM_NAMES[a]] -= recipe[a] * count;
+        reserved_atoms[a] += recipe[a] * count;
+    }
+    ++inventory_version;
+    uint64_t id = next_reservation_id++;
+    reservations[id] = Reservation{(int8_t)mol, count};
+    timers.schedule(now_ms() + ttl_ms, TIMER_RESERVATION, id);
+    req_log() << tag << " Reserved " << count << " of " << MOLECULE_NAMES[mol] << " as #" << id << " for " << ttl_ms
+              << " ms" << std::endl;
+    return frame_arena.format("RESERVED %llu", (unsigned long long)id);
+}
+
+// Ends a reservation; commit turns the held atoms into molecules, otherwise they go back.
+bool release_reservation(uint64_t id, bool commit) {
+    auto it = reservations.find(id);
+    if (it == reservations.end()) return false;
+    int mol = it->second.mol, count = it->second.count;
+    reservations.erase(it);
+
+    const int* recipe = MOLECULE_RECIPES[mol];
+    unsigned returned_atoms = 0;
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        reserved_atoms[a] -= recipe[a] * count;
+        if (!commit && recipe[a] > 0) {
+            atoms[ATOM_NAMES[a]] += recipe[a] * count;
+            returned_atoms |= 1u << a;
+        }
+    }
+    ++inventory_version;
+    if (commit) {
+        molecules[MOLECULE_NAMES[mol]] += count;
+        if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
+    } else {
+        wake_waiting_orders(returned_atoms);
+    }
+    return true;
+}
+
+// RESERVE, COMMIT and CANCEL. Returns an empty reply if the line is none of them.
+std::string_view handle_reservation_command(const char* tag, std::string_view line, const std::string_view* words,
+                                            size_t n) {
+    if (n >= 5 && words[0] == "RESERVE" && words[n - 2] == "TTL") {
+        long long count = parse_number(words[n - 3], INT_MAX), ttl = parse_number(words[n - 1], INT_MAX);
+        std::string_view name = join_words(words, 1, n - 3);
+        int mol = molecule_id(name.data(), name.size());
+        if (mol < 0 || count <= 0 || ttl <= 0) {
+            req_log() << tag << " Invalid reservation: " << line << std::endl;
+            return "FAILED";
+        }
+        std::string_view reply = reserve_molecule(tag, mol, (int)count, (int)ttl);
+        print_atoms();
+        return reply;
+    }
+    if (n == 2 && (words[0] == "COMMIT" || words[0] == "CANCEL")) {
+        bool commit = words[0] == "COMMIT";
+        long long id = parse_number(words[1], LLONG_MAX);
+        if (id < 0 || !release_reservation((uint64_t)id, commit)) {
+            req_log() << tag << " Unknown or expired reservation: " << words[1] << std::endl;
+            return "FAILED";
+        }
+        req_log() << tag << (commit ? " Committed" : " Cancelled") << " reservation #" << id << std::endl;
+        print_atoms();
+        return "OK";
+    }
+    return std::string_view();
+}
+
+// ORDER <ALL_OR_NOTHING|PARTIAL> <molecule> <n> [<molecule> <n> ...]
+// The whole order is checked against the free atoms in one pass and saved once. ALL_OR_NOTHING
+// makes every line or none; PARTIAL fills the lines in order, as far as the atoms go. The reply
+// lists the molecules made per line ("OK 2 2 1"), or is FAILED if nothing was made.
+std::string_view handle_order_command(const char* tag, std::string_view line, const std::string_view* words,
+                                      size_t n) {
+    if (n < 1 || words[0] != "ORDER") return std::string_view();
+
+    constexpr size_t MAX_LINES = MAX_WORDS / 2;
+    int mols[MAX_LINES], counts[MAX_LINES];
+    size_t lines = 0;
+    bool all_or_nothing = n >= 2 && words[1] == "ALL_OR_NOTHING";
+    bool valid = n >= 4 && (all_or_nothing || words[1] == "PARTIAL");
+    size_t name_start = 2;
+    for (size_t i = 2; valid && i < n; ++i) {
+        long long count = parse_number(words[i], INT_MAX);
+        if (count < 0) continue;
+        std::string_view name = i > name_start ? join_words(words, name_start, i) : std::string_view();
+        int mol = molecule_id(name.data(), name.size());
+        if (mol < 0 || count == 0) {
+            valid = false;
+        } else {
+            mols[lines] = mol;
+            counts[lines++] = (int)count;
+        }
+        name_start = i + 1;
+    }
+    if (!valid || lines == 0 || name_start < n) {
+        req_log() << tag << " Invalid order: " << line << std::endl;
+        return "FAILED";
+    }
+
+    int free_atoms[ATOM_COUNT];
+    for (int a = 0; a < ATOM_COUNT; ++a) free_atoms[a] = atoms[ATOM_NAMES[a]];
+    int made[MAX_LINES];
+    int total = 0;
+    if (all_or_nothing) {
+        int64_t need[ATOM_COUNT] = {};
+        for (size_t l = 0; l < lines; ++l) {
+            for (int a = 0; a < ATOM_COUNT; ++a) need[a] += (int64_t)MOLECULE_RECIPES[mols[l]][a] * counts[l];
+        }
+        bool enough = true;
+        for (int a = 0; a < ATOM_COUNT; ++a) enough = enough && need[a] <= free_atoms[a];
+        for (size_t l = 0; l < lines; ++l) made[l] = enough ? counts[l] : 0;
+    } else {
+        for (size_t l = 0; l < lines; ++l) {
+            const int* recipe = MOLECULE_RECIPES[mols[l]];
+            int possible = counts[l];
+            for (int a = 0; a < ATOM_COUNT; ++a) {
+                if (recipe[a] > 0) possible = std::min(possible, free_atoms[a] / recipe[a]);
+            }
+            for (int a = 0; a < ATOM_COUNT; ++a) free_atoms[a] -= recipe[a] * possible;
+            made[l] = possible;
+        }
+    }
+    for (size_t l = 0; l < lines; ++l) total += made[l];
+    if (total == 0) {
+        req_log() << tag << " FAILED order: " << line << std::endl;
+        return "FAILED";
+    }
+
+    size_t cap = 3 + lines * 12;  // "OK", " <made>" per line and the NUL
+    char* out = frame_arena.alloc_array<char>(cap);
+    size_t len = std::snprintf(out, cap, "OK");
+    for (size_t l = 0; l < lines; ++l) {
+        if (made[l] > 0) {
+            for (int a = 0; a < ATOM_COUNT; ++a) atoms[ATOM_NAMES[a]] -= MOLECULE_RECIPES[mols[l]][a] * made[l];
+            molecules[MOLECULE_NAMES[mols[l]]] += made[l];
+        }
+        len += std::snprintf(out + len, cap - len, " %d", made[l]);
+    }
+    std::string_view reply(out, len);
+    ++inventory_version;
+    if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
+    req_log() << tag << " Order filled (" << reply << "): " << line << std::endl;
+    print_atoms();
+    return reply;
+}
+
+// Slow path for datagram lines that are not DELIVER. Returns an empty reply if the line is
+// not a known command.
+// "FWD <seq> DELIVER <molecule> <n>" from a peer bar (see --peer) is served from local stock
+// only, so a forwarded order is never forwarded again.
+std::string_view handle_forwarded_delivery(const char* tag, std::string_view line) {
+    if (line.compare(0, 4, "FWD ") != 0) return std::string_view();
+    size_t space = line.find(' ', 4);
+    if (space == std::string_view::npos) return "FAILED";
+    std::string_view seq = line.substr(4, space - 4);
+    std::string_view inner = line.substr(space + 1);
+    ParsedCommand cmd{};
+    size_t consumed = 0;
+    int delivered = 0;
+    if (parse_command_batch(inner.data(), inner.size(), &cmd, 1, true, &consumed) == 1 && cmd.op == OP_DELIVER &&
+        cmd.id >= 0) {
+        delivered = deliver_molecule(cmd.id, cmd.count);
+    }
+    req_log() << tag << " Peer order #" << seq << ": delivered " << delivered << " of " << cmd.count << std::endl;
+    if (delivered > 0) return frame_arena.format("FWD %.*s OK %d", (int)seq.size(), seq.data(), delivered);
+    return frame_arena.format("FWD %.*s FAILED", (int)seq.size(), seq.data());
+}
+
+std::string_view handle_datagram_command(const char* tag, std::string_view line) {
+    std::string_view words[MAX_WORDS];
+    size_t n = split_words(line, words);
+    std::string_view reply = handle_forwarded_delivery(tag, line);
+    if (!reply.empty()) return reply;
+    reply = handle_inventory_query(words, n);
+    if (!reply.empty()) return reply.substr(0, reply.size() - 1);  // datagram replies carry no newline
+    reply = handle_reservation_command(tag, line, words, n);
+    if (reply.empty()) reply = handle_order_command(tag, line, words, n);
+    return reply;
+}
+
+// --snapshot <file>: persistence without full rewrites on the event loop. Each loop iteration
+// that changed the inventory appends one "<version> KEY=level;...\n" record of the levels that
+// moved to <file>.log. SNAPSHOT forks; the child writes the binary snapshot from its
+// copy-on-write view of memory while the parent keeps serving, and once it succeeds the log is
+// cut down to the records written after the fork. Startup loads the snapshot and replays the
+// log records newer than it. Persisted atom levels include reserved atoms, as in the save file.
+constexpr int PERSISTED_KEYS = ATOM_COUNT + MOL_COUNT;
+
+std::string snapshot_path, mutation_log_path;
+int mutation_log_fd = -1;
+off_t mutation_log_bytes = 0;
+off_t snapshot_log_limit = 1 << 20;
+int snapshot_interval_seconds = 0;
+int logged_level[PERSISTED_KEYS];
+uint64_t logged_version = 0;
+pid_t snapshot_child = -1;
+off_t snapshot_log_offset = 0;
+int64_t snapshot_started_ms = 0;
+
+int persisted_level(int key) {
+    if (key < ATOM_COUNT) return atoms[ATOM_NAMES[key]] + reserved_atoms[key];
+    return molecules[MOLECULE_NAMES[key - ATOM_COUNT]];
+}
+
+// "<version> KEY=level;...\n" for the persisted levels that differ from last_levels (which is
+// updated), or an empty string if none do.
+std::string_view persisted_changes(int* last_levels) {
+    size_t cap = 22;  // "<version> ", the newline and the NUL
+    for (int key = 0; key < PERSISTED_KEYS; ++key) cap += std::strlen(stock_key_name(key)) + 13;
+    char* record = frame_arena.alloc_array<char>(cap);
+    size_t len = std::snprintf(record, cap, "%llu ", (unsigned long long)inventory_version);
+    bool any = false;
+    for (int key = 0; key < PERSISTED_KEYS; ++key) {
+        int level = persisted_level(key);
+        if (level == last_levels[key]) continue;
+        last_levels[key] = level;
+        len += std::snprintf(record + len, cap - len, "%s=%d;", stock_key_name(key), level);
+        any = true;
+    }
+    if (!any) return std::string_view();
+    record[len++] = '\n';
+    record[len] = '\0';
+    return std::string_view(record, len);
+}
+
+void flush_mutation_log() {
+    if (mutation_log_fd < 0 || logged_version == inventory_version) return;
+    std::string_view record = persisted_changes(logged_level);
+    logged_version = inventory_version;
+    if (record.empty()) return;  // reservations moved atoms without changing totals
+    if (!write_all(mutation_log_fd, record.data(), record.size())) {
+        perror("[ERROR] mutation log write");
+        return;
+    }
+    mutation_log_bytes += record.size();
+}
+
+void start_snapshot(const char* reason) {
+    if (snapshot_path.empty() || snapshot_child > 0) return;
+    flush_mutation_log();
+
+    // Everything the child needs is prepared here, so it never allocates after fork().
+    SnapshotEntry entries[PERSISTED_KEYS] = {};
+    for (int key = 0; key < PERSISTED_KEYS; ++key) {
+        std::strncpy(entries[key].name, stock_key_name(key), sizeof(entries[key].name) - 1);
+        entries[key].level = persisted_level(key);
+    }
+    std::string tmp_path = snapshot_path + ".tmp";
+    uint64_t version = inventory_version;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("[ERROR] fork (snapshot)");
+        return;
+    }
+    if (pid == 0) {
+        if (!loop_cpus.empty()) sched_setaffinity(0, sizeof(startup_cpus), &startup_cpus);
+        bool ok = write_snapshot(snapshot_path.c_str(), tmp_path.c_str(), version, entries, PERSISTED_KEYS);
+        _exit(ok ? 0 : 1);
+    }
+    snapshot_child = pid;
+    snapshot_log_offset = mutation_log_bytes;
+    snapshot_started_ms = now_ms();
+    timers.schedule(snapshot_started_ms + 5, TIMER_SNAPSHOT_POLL, 0);
+    std::cout << "[SNAPSHOT] Started (" << reason << "), child PID " << pid << ", version " << version << std::endl;
+}
+
+// Keeps only the log records written after the snapshot's fork.
+bool truncate_mutation_log() {
+    std::string tail(mutation_log_bytes - snapshot_log_offset, '\0');
+    if (pread(mutation_log_fd, &tail[0], tail.size(), snapshot_log_offset) != (ssize_t)tail.size()) {
+        perror("[ERROR] mutation log read");
+        return false;
+    }
+    std::string tmp_path = mutation_log_path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0 || !write_all(fd, tail.data(), tail.size()) || rename(tmp_path.c_str(), mutation_log_path.c_str()) < 0) {
+        perror("[ERROR] mutation log truncate");
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    close(mutation_log_fd);
+    mutation_log_fd = fd;
+    mutation_log_bytes = tail.size();
+    return true;
+}
+
+void poll_snapshot_child() {
+    int status = 0;
+    pid_t done = waitpid(snapshot_child, &status, WNOHANG);
+    if (done == 0) {
+        timers.schedule(now_ms() + 5, TIMER_SNAPSHOT_POLL, 0);
+        return;
+    }
+    snapshot_child = -1;
+    if (done < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "[ERROR] Snapshot child failed; keeping the mutation log" << std::endl;
+        return;
+    }
+    off_t dropped = snapshot_log_offset;
+    if (!truncate_mutation_log()) return;
+    std::cout << "[SNAPSHOT] Written to " << snapshot_path << " in " << now_ms() - snapshot_started_ms
+              << " ms; dropped " << dropped << " log bytes" << std::endl;
+}
+
+void set_persisted_level(const std::string& name, int level) {
+    int key = stock_key_id(name.data(), name.size());
+    if (key >= 0 && key < ATOM_COUNT) atoms[ATOM_NAMES[key]] = level;
+    else if (key >= ATOM_COUNT && key < PERSISTED_KEYS) molecules[MOLECULE_NAMES[key - ATOM_COUNT]] = level;
+}
+
+// Applies one "<version> KEY=level;..." record; returns its version, or 0 if it is malformed.
+uint64_t apply_persisted_record(const std::string& line) {
+    size_t space = line.find(' ');
+    char* digits_end = nullptr;
+    uint64_t version = std::strtoull(line.c_str(), &digits_end, 10);
+    if (space == std::string::npos || digits_end != line.c_str() + space) return 0;
+    for (size_t pos = space + 1; pos < line.size();) {
+        size_t eq = line.find('=', pos), end = line.find(';', pos);
+        if (eq == std::string::npos || end == std::string::npos || eq > end) break;
+        set_persisted_level(line.substr(pos, eq - pos), std::atoi(line.c_str() + eq + 1));
+        pos = end + 1;
+    }
+    inventory_version = std::max(inventory_version, version);
+    return version;
+}
+
+// Loads the snapshot, replays newer log records and opens the log for appending.
+bool open_snapshot_store() {
+    mutation_log_path = snapshot_path + ".log";
+    auto load_start = std::chrono::steady_clock::now();
+    SnapshotView view;
+    bool have_snapshot = view.open(snapshot_path.c_str());
+    uint64_t snapshot_version = have_snapshot ? view.header().inventory_version : 0;
+    if (have_snapshot) {
+        for (uint32_t i = 0; i < view.entry_count(); ++i) {
+            const SnapshotEntry& entry = view.entries()[i];
+            set_persisted_level(SnapshotView::entry_name(entry), (int)entry.level);
+        }
+        inventory_version = std::max(inventory_version, snapshot_version);
+        view.close();
+    } else if (access(snapshot_path.c_str(), F_OK) == 0) {
+        std::cerr << "[ERROR] " << snapshot_path << " is not a valid snapshot: " << view.error() << std::endl;
+        return false;
+    }
+
+    size_t replayed = 0;
+    std::ifstream log(mutation_log_path);
+    std::string line;
+    while (std::getline(log, line)) {
+        if (log.eof()) break;  // torn last record from a crash
+        uint64_t version = std::strtoull(line.c_str(), nullptr, 10);
+        if (have_snapshot && version <= snapshot_version) continue;
+        if (apply_persisted_record(line)) ++replayed;
+    }
+
+    mutation_log_fd = open(mutation_log_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (mutation_log_fd < 0) {
+        perror("[ERROR] open mutation log");
+        return false;
+    }
+    mutation_log_bytes = lseek(mutation_log_fd, 0, SEEK_END);
+    for (int key = 0; key < PERSISTED_KEYS; ++key) logged_level[key] = persisted_level(key);
+    logged_version = inventory_version;
+    std::cout << "[INFO] Snapshot store " << snapshot_path << ": version " << inventory_version << ", replayed "
+              << replayed << " log records in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count()
+              << " ms" << std::endl;
+
+    if (!have_snapshot) {
+        SnapshotEntry initial[PERSISTED_KEYS] = {};
+        for (int key = 0; key < PERSISTED_KEYS; ++key) {
+            std::strncpy(initial[key].name, stock_key_name(key), sizeof(initial[key].name) - 1);
+            initial[key].level = persisted_level(key);
+        }
+        std::string tmp_path = snapshot_path + ".tmp";
+        if (!write_snapshot(snapshot_path.c_str(), tmp_path.c_str(), inventory_version, initial, PERSISTED_KEYS)) {
+            perror("[ERROR] initial snapshot");
+            return false;
+        }
+        snapshot_log_offset = mutation_log_bytes;
+        if (!truncate_mutation_log()) return false;
+    }
+    if (snapshot_interval_seconds > 0) {
+        timers.schedule(now_ms() + snapshot_interval_seconds * 1000LL, TIMER_SNAPSHOT, 0);
+    }
+    return true;
+}
+
+// Called once per loop iteration: append this iteration's changes and check the log size.
+void persist_iteration() {
+    if (mutation_log_fd < 0) return;
+    flush_mutation_log();
+    if (mutation_log_bytes >= snapshot_log_limit) start_snapshot("log size");
+}
+
+// === Replication ===
+// A primary started with --replication-port / --replication-path accepts standbys. Each one
+// first gets the full persisted state and then, per loop iteration that changed it, the same
+// "<version> KEY=level;...\n" record the mutation log gets; it answers "ACK <version>\n".
+// Records carry absolute levels, so re-sending one is harmless. With --sync-replication the
+// iteration's datagram replies and stream acks are held until every sync standby has acked;
+// a standby that misses --sync-timeout drops to async until it catches up. Output to a
+// standby never blocks the loop: what its socket does not take waits in outbuf for EPOLLOUT.
+// A bar started with --standby-of <host:port|path> applies the records and opens no client
+// listeners until the primary connection ends (or PROMOTE on the console), then binds them.
+// If they cannot be bound yet it stays a standby; after losing the primary it retries.
+int replication_port = -1;
+std::string replication_path;
+int replication_tcp_sock = -1, replication_uds_sock = -1;
+bool sync_replication = false;
+int sync_timeout_ms = 1000;
+
+constexpr size_t REPLICA_OUTBUF_LIMIT = 16 << 20;  // a standby this far behind is dropped
+constexpr int TAKEOVER_RETRY_MS = 50;
+
+struct Replica {
+    int fd;
+    bool sync;
+    bool writing;     // EPOLLOUT is armed
+    uint64_t acked;
+    std::string inbuf;
+    std::string outbuf;
+};
+std::vector<Replica> replicas;
+int replicated_level[PERSISTED_KEYS];
+uint64_t replicated_version = 0;
+
+std::string standby_of;
+int primary_fd = -1;
+std::string primary_inbuf;
+
+bool open_listeners();
+void close_listeners();
+bool open_shm_transport();
+void replicate_iteration();
+
+bool send_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+bool add_to_epoll(int fd) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+Replica* find_replica(int fd) {
+    for (Replica& replica : replicas) {
+        if (replica.fd == fd) return &replica;
+    }
+    return nullptr;
+}
+
+void drop_replica(Replica& replica) {
+    std::cout << "[REPL] Standby FD=" << replica.fd << " disconnected" << std::endl;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, replica.fd, nullptr);
+    close(replica.fd);
+    replica.fd = -1;
+}
+
+// Sends what the socket takes now and arms EPOLLOUT for the rest; false once the standby is
+// gone or too far behind.
+bool flush_replica(Replica& replica) {
+    size_t sent = 0;
+    while (sent < replica.outbuf.size()) {
+        ssize_t n = send(replica.fd, replica.outbuf.data() + sent, replica.outbuf.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    replica.outbuf.erase(0, sent);
+    if (replica.outbuf.size() > REPLICA_OUTBUF_LIMIT) {
+        std::cerr << "[REPL] Standby FD=" << replica.fd << " is not reading" << std::endl;
+        return false;
+    }
+    bool want = !replica.outbuf.empty();
+    if (want != replica.writing) {
+        replica.writing = want;
+        epoll_event ev{};
+        ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.fd = replica.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, replica.fd, &ev);
+    }
+    return true;
+}
+
+bool send_to_replica(Replica& replica, std::string_view data) {
+    replica.outbuf.append(data.data(), data.size());
+    return flush_replica(replica);
+}
+
+void accept_replica(int listen_sock) {
+    int fd = accept4(listen_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        perror("[ERROR] accept4 (standby)");
+        return;
+    }
+    int one = 1;
+    if (listen_sock == replication_tcp_sock) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (!add_to_epoll(fd)) {
+        perror("[ERROR] standby setup");
+        close(fd);
+        return;
+    }
+
+    // Bring the existing standbys level with us first, so one baseline serves everyone.
+    replicate_iteration();
+    std::fill(replicated_level, replicated_level + PERSISTED_KEYS, INT_MIN);
+    replicated_version = inventory_version;
+    replicas.push_back(Replica{fd, sync_replication, false, 0, std::string(), std::string()});
+    if (!send_to_replica(replicas.back(), persisted_changes(replicated_level))) {
+        drop_replica(replicas.back());
+        return;
+    }
+    std::cout << "[REPL] Standby connected: FD=" << fd << (sync_replication ? " (sync)" : " (async)")
+              << ", state version " << inventory_version << std::endl;
+}
+
+// Reads "ACK <version>" lines; returns false once the standby has gone away.
+bool read_replica_acks(Replica& replica) {
+    char buf[512];
+    ssize_t n = recv(replica.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    if (n == 0) return false;
+    replica.inbuf.append(buf, n);
+    for (size_t nl; (nl = replica.inbuf.find('\n')) != std::string::npos; replica.inbuf.erase(0, nl + 1)) {
+        if (replica.inbuf.compare(0, 4, "ACK ") == 0) {
+            replica.acked = std::max<uint64_t>(replica.acked, std::strtoull(replica.inbuf.c_str() + 4, nullptr, 10));
+        }
+    }
+    if (sync_replication && !replica.sync && replica.acked >= replicated_version) {
+        replica.sync = true;
+        std::cout << "[REPL] Standby FD=" << replica.fd << " caught up; sync again" << std::endl;
+    }
+    return true;
+}
+
+// Handles poll/epoll readiness (the bits are the same) on a standby's socket; false once it
+// has to be dropped.
+bool service_replica(Replica& replica, unsigned events) {
+    if ((events & EPOLLOUT) && !flush_replica(replica)) return false;
+    return !(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) || read_replica_acks(replica);
+}
+
+void wait_for_sync_acks(uint64_t version) {
+    int64_t deadline = now_ms() + sync_timeout_ms;
+    std::vector<pollfd> waiting;
+    while (true) {
+        waiting.clear();
+        for (const Replica& replica : replicas) {
+            if (replica.fd < 0 || !replica.sync || replica.acked >= version) continue;
+            waiting.push_back(pollfd{replica.fd, (short)(POLLIN | (replica.outbuf.empty() ? 0 : POLLOUT)), 0});
+        }
+        if (waiting.empty()) return;
+        int64_t left = deadline - now_ms();
+        if (left <= 0) {
+            for (Replica& replica : replicas) {
+                if (replica.fd < 0 || !replica.sync || replica.acked >= version) continue;
+                replica.sync = false;
+                std::cerr << "[REPL] Standby FD=" << replica.fd << " missed the sync deadline; now async" << std::endl;
+            }
+            return;
+        }
+        poll(waiting.data(), waiting.size(), (int)left);
+        for (const pollfd& p : waiting) {
+            Replica* replica = p.revents ? find_replica(p.fd) : nullptr;
+            if (replica && !service_replica(*replica, p.revents)) drop_replica(*replica);
+        }
+    }
+}
+
+// Called once per loop iteration, before replies and acks go out.
+void replicate_iteration() {
+    if (replicas.empty() || replicated_version == inventory_version) return;
+    std::string_view record = persisted_changes(replicated_level);
+    replicated_version = inventory_version;
+    if (!record.empty()) {
+        for (Replica& replica : replicas) {
+            if (replica.fd >= 0 && !send_to_replica(replica, record)) drop_replica(replica);
+        }
+        if (sync_replication) wait_for_sync_acks(replicated_version);
+    }
+    replicas.erase(std::remove_if(replicas.begin(), replicas.end(), [](const Replica& r) { return r.fd < 0; }),
+                   replicas.end());
+}
+
+// Connects a blocking stream socket to "host:port" or a Unix socket path and adds it to epoll;
+// returns -1 (after logging) on failure.
+int connect_stream(const std::string& spec, const char* what) {
+    size_t colon = spec.rfind(':');
+    bool inet = colon != std::string::npos && spec.find('/') == std::string::npos;
+    int fd = socket(inet ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_storage addr{};
+    socklen_t addrlen;
+    if (inet) {
+        hostent* host = gethostbyname(spec.substr(0, colon).c_str());
+        if (!host) {
+            std::cerr << "[ERROR] Unknown " << what << " host: " << spec << std::endl;
+            close(fd);
+            return -1;
+        }
+        sockaddr_in* in = (sockaddr_in*)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(std::atoi(spec.c_str() + colon + 1));
+        std::memcpy(&in->sin_addr.s_addr, host->h_addr, host->h_length);
+        addrlen = sizeof(sockaddr_in);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        sockaddr_un* un = (sockaddr_un*)&addr;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, spec.c_str(), sizeof(un->sun_path) - 1);
+        addrlen = sizeof(sockaddr_un);
+    }
+    if (connect(fd, (sockaddr*)&addr, addrlen) < 0 || !add_to_epoll(fd)) {
+        std::cerr << "[ERROR] connect to " << what << " " << spec << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool connect_to_primary() {
+    primary_fd = connect_stream(standby_of, "primary");
+    return primary_fd >= 0;
+}
+
+void close_primary() {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, primary_fd, nullptr);
+    close(primary_fd);
+    primary_fd = -1;
+}
+
+// Opens the client listeners and the shared-memory transport. If something is still held
+// (by a primary that is alive, or still exiting) everything is closed again and the bar
+// stays a standby; the caller decides whether to retry.
+bool take_over(const char* reason) {
+    auto start = std::chrono::steady_clock::now();
+    if (!open_listeners() || !open_shm_transport()) {
+        close_listeners();
+        shm.destroy();
+        return false;
+    }
+    if (primary_fd >= 0) close_primary();
+    standby_of.clear();
+    std::cout << "[STANDBY] Took over (" << reason << ") at version " << inventory_version << " in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms"
+              << std::endl;
+    print_atoms();
+    return true;
+}
+
+// After the primary is gone: its listeners can outlive its replication socket by a moment
+// while it exits, so keep trying, backing off up to a second between attempts.
+void retry_take_over(int delay_ms) {
+    if (standby_of.empty() || take_over("primary connection lost")) return;
+    int next = std::min(delay_ms * 2, 1000);
+    if (delay_ms == TAKEOVER_RETRY_MS) std::cerr << "[STANDBY] Client listeners still in use; retrying" << std::endl;
+    timers.schedule(now_ms() + delay_ms, TIMER_TAKEOVER, next);
+}
+
+void read_primary_stream() {
+    char buf[65536];
+    ssize_t n = recv(primary_fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) {
+        close_primary();
+        retry_take_over(TAKEOVER_RETRY_MS);
+        return;
+    }
+    primary_inbuf.append(buf, n);
+    uint64_t applied = 0;
+    for (size_t nl; (nl = primary_inbuf.find('\n')) != std::string::npos; primary_inbuf.erase(0, nl + 1)) {
+        uint64_t version = apply_persisted_record(primary_inbuf.substr(0, nl));
+        if (version) applied = version;
+    }
+    if (applied) {
+        send_all(primary_fd, frame_arena.format("ACK %llu\n", (unsigned long long)applied));
+        req_log() << "[STANDBY] Applied up to version " << applied << std::endl;
     }
-    out.close();
-    flock(fd, LOCK_UN);
-    close(fd);
-    std::cout << "[SAVE] Inventory saved to " << path << " by PID " << getpid() << std::endl;
 }
 
-void print_atoms() {
-    std::cout << "Current atom counts: ";
-    for (const auto& kv : atoms)
-        std::cout << kv.first << ": " << kv.second << "  ";
-    std::cout << std::endl;
+// === Federation ===
+// --peer host:port (repeatable) names another bar's UDP port. Every PEER_GOSSIP_MS each peer
+// is asked "INVENTORY IF-NEWER <v>", which keeps a copy of its atom levels here. When a
+// datagram DELIVER comes up short, the remainder is split across the peers that look able to
+// make it, most stock first, as "FWD <seq> DELIVER <molecule> <n>" datagrams sent together on
+// non-blocking sockets. The client gets one combined reply once every peer has answered or
+// --peer-timeout has passed; the loop keeps serving in between.
+constexpr int PEER_GOSSIP_MS = 100;
+int peer_timeout_ms = 200;
+
+struct Peer {
+    std::string name;
+    int fd;
+    uint64_t version;  // 0 forces a full INVENTORY on the next gossip round
+    int atoms[ATOM_COUNT];
+};
+std::vector<Peer> peers;
+
+struct ForwardedOrder {
+    const char* tag;
+    int sock;
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    int8_t mol;
+    int32_t delivered;
+    int outstanding;
+    int32_t request_tag;
+};
+std::unordered_map<uint64_t, ForwardedOrder> forwarded_orders;
+std::unordered_map<uint64_t, uint64_t> forward_requests;  // FWD seq -> forwarded order id
+uint64_t next_forward_id = 1;
+
+bool connect_peer(const std::string& spec) {
+    size_t colon = spec.rfind(':');
+    hostent* host = colon == std::string::npos ? nullptr : gethostbyname(spec.substr(0, colon).c_str());
+    if (!host) {
+        std::cerr << "[ERROR] Bad peer address: " << spec << std::endl;
+        return false;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(std::atoi(spec.c_str() + colon + 1));
+    std::memcpy(&addr.sin_addr.s_addr, host->h_addr, host->h_length);
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || !add_to_epoll(fd)) {
+        perror("[ERROR] peer socket");
+        return false;
+    }
+    peers.push_back(Peer{spec, fd, 0, {}});
+    return true;
 }
 
+Peer* find_peer(int fd) {
+    for (Peer& peer : peers) {
+        if (peer.fd == fd) return &peer;
+    }
+    return nullptr;
+}
 
-void handle_sigint(int) {
-    std::cout << "\n[EXIT] Caught Ctrl+C, saving inventory..." << std::endl;
-    if (!save_file_path.empty()) {
-        save_inventory_to_file(save_file_path);
+void gossip_peers() {
+    for (Peer& peer : peers) {
+        std::string_view query = peer.version ? frame_arena.format("INVENTORY IF-NEWER %llu", (unsigned long long)peer.version)
+                                              : std::string_view("INVENTORY");
+        send(peer.fd, query.data(), query.size(), MSG_DONTWAIT);
     }
-    exit(0);
+    timers.schedule(now_ms() + PEER_GOSSIP_MS, TIMER_PEER_GOSSIP, 0);
 }
 
+int peer_capacity(const Peer& peer, int mol) {
+    int possible = INT_MAX;
+    for (int a = 0; a < ATOM_COUNT; ++a) {
+        if (MOLECULE_RECIPES[mol][a] > 0) possible = std::min(possible, peer.atoms[a] / MOLECULE_RECIPES[mol][a]);
+    }
+    return possible;
+}
 
-void timeout_handler(int) {
-    std::cout << "\n[TIMEOUT] No activity received within " << timeout_seconds << " seconds. Shutting down.\n";
-    exit(0);
+// Sends the shortfall to peers; false when no peer looks able to help (answer locally then).
+bool forward_shortfall(const char* tag, int sock, const sockaddr* addr, socklen_t addrlen, const ParsedCommand& cmd,
+                       int delivered) {
+    int mol = cmd.id, missing = cmd.count - delivered;
+    uint64_t id = next_forward_id++;
+    ForwardedOrder order{tag, sock, {}, addrlen, (int8_t)mol, delivered, 0, cmd.request_tag};
+    std::memcpy(&order.addr, addr, addrlen);
+    while (missing > 0) {
+        Peer* best = nullptr;
+        int best_capacity = 0;
+        for (Peer& peer : peers) {
+            int capacity = peer_capacity(peer, mol);
+            if (capacity > best_capacity) {
+                best = &peer;
+                best_capacity = capacity;
+            }
+        }
+        if (!best) break;
+        int ask = std::min(missing, best_capacity);
+        uint64_t seq = next_forward_id++;
+        std::string_view request = frame_arena.format("FWD %llu DELIVER %s %d", (unsigned long long)seq, MOLECULE_NAMES[mol], ask);
+        // Count the atoms as gone until the peer's next INVENTORY says otherwise.
+        for (int a = 0; a < ATOM_COUNT; ++a) best->atoms[a] -= MOLECULE_RECIPES[mol][a] * ask;
+        best->version = 0;
+        if (send(best->fd, request.data(), request.size(), MSG_DONTWAIT) < 0) continue;
+        forward_requests[seq] = id;
+        ++order.outstanding;
+        missing -= ask;
+    }
+    if (order.outstanding == 0) return false;
+    forwarded_orders[id] = order;
+    timers.schedule(now_ms() + peer_timeout_ms, TIMER_FORWARD, id);
+    req_log() << tag << " Forwarded " << MOLECULE_NAMES[mol] << " shortfall to " << order.outstanding << " peer(s)"
+              << std::endl;
+    return true;
 }
 
-void reset_alarm() {
-    if (timeout_seconds > 0) alarm(timeout_seconds);
+void finish_forwarded_order(uint64_t id) {
+    auto it = forwarded_orders.find(id);
+    if (it == forwarded_orders.end()) return;
+    const ForwardedOrder& order = it->second;
+    std::string_view reply = order.delivered > 0 ? frame_arena.format("OK %d", order.delivered) : std::string_view("FAILED");
+    queue_reply(order.sock, (const sockaddr*)&order.addr, order.addrlen, tag_reply(reply, order.request_tag));
+    req_log() << order.tag << " Delivered " << order.delivered << " of " << MOLECULE_NAMES[order.mol]
+              << " with peer help" << std::endl;
+    forwarded_orders.erase(it);
 }
 
-void load_inventory_from_file(const std::string& filepath) {
-    std::ifstream in(filepath);
-    if (!in) return;
-    std::string key;
-    int value;
-    while (in >> key >> value) {
-        if (atoms.count(key)) atoms[key] = value;
-        else if (molecules.count(key)) molecules[key] = value;
+// A forwarded order whose peers did not all answer in time gets what has arrived so far.
+void expire_forwarded_order(uint64_t id) {
+    if (forwarded_orders.find(id) == forwarded_orders.end()) return;
+    for (auto it = forward_requests.begin(); it != forward_requests.end();) {
+        it = it->second == id ? forward_requests.erase(it) : std::next(it);
     }
-    std::cout << "[INFO] Inventory loaded from: " << filepath << std::endl;
+    std::cerr << "[PEER] Order timed out waiting for peers" << std::endl;
+    finish_forwarded_order(id);
 }
 
-void handle_tcp_command(int client_sock) {
-    std::cout << "[DEBUG] handle_tcp_command called for FD=" << client_sock << std::endl;
+void read_peer_replies(Peer& peer) {
     char buffer[BUFFER_SIZE];
-    ssize_t len = recv(client_sock, buffer, BUFFER_SIZE - 1, 0);
-    if (len <= 0) {
-        std::cout << "[DEBUG] TCP client disconnected: FD=" << client_sock << std::endl;
-        close(client_sock);
-        tcp_clients.erase(std::remove(tcp_clients.begin(), tcp_clients.end(), client_sock), tcp_clients.end());
-        return;
+    ssize_t len;
+    while ((len = recv(peer.fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        std::string_view reply(buffer, len);
+        std::string_view words[MAX_WORDS];
+        size_t n = split_words(reply, words);
+        if (n >= 2 && words[0] == "INVENTORY") {
+            peer.version = std::max(0LL, parse_number(words[1], LLONG_MAX));
+            for (size_t pos = words[1].data() + words[1].size() + 1 - buffer; pos < reply.size();) {
+                size_t eq = reply.find('=', pos), end = reply.find(';', pos);
+                if (eq == std::string_view::npos || end == std::string_view::npos || eq > end) break;
+                int key = stock_key_id(buffer + pos, eq - pos);
+                if (key >= 0 && key < ATOM_COUNT) peer.atoms[key] = (int)std::max(0LL, parse_number(reply.substr(eq + 1, end - eq - 1), INT_MAX));
+                pos = end + 1;
+            }
+        } else if (n >= 3 && words[0] == "FWD") {
+            auto request = forward_requests.find((uint64_t)parse_number(words[1], LLONG_MAX));
+            if (request == forward_requests.end()) continue;  // answered after the order timed out
+            auto order = forwarded_orders.find(request->second);
+            forward_requests.erase(request);
+            if (order == forwarded_orders.end()) continue;
+            long long made = words[2] == "OK" && n == 4 ? parse_number(words[3], INT_MAX) : 0;
+            if (made > 0) order->second.delivered += (int)made;  // anything malformed is a failed share
+            if (--order->second.outstanding == 0) finish_forwarded_order(order->first);
+        }
     }
-    
+}
 
-    reset_alarm();
+// === Leases (edge side) ===
+// --lease-from <host:port|path> names a central bar's stream listener. Each atom is leased in
+// --lease-chunk pieces and DELIVERs are served from the held stock; an atom that falls below
+// --lease-low-water gets one refill request in flight, answered without stalling the loop. A
+// refill the central bar cannot grant is retried after LEASE_RETRY_MS. On shutdown the leased
+// stock that is still free goes back.
+constexpr int LEASE_RETRY_MS = 1000;
+std::string lease_from;
+int lease_chunk = 10000;
+int lease_low_water = -1;  // default: a quarter chunk
+int lease_fd = -1;
+std::string lease_inbuf;
+long long leased_in[ATOM_COUNT];
+bool lease_pending[ATOM_COUNT];
 
-    buffer[len] = '\0';
-    std::string type;
-    int amount;
-
-    char type_buf[64];
-    if (sscanf(buffer, "ADD %63s %d", type_buf, &amount) == 2) {
-        type = std::string(type_buf);
-        if (atoms.count(type)) {
-            atoms[type] += amount;
-            std::cout << "[TCP] Added " << amount << " of " << type << std::endl;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else {
-            std::cout << "[TCP] Invalid atom type: " << type << std::endl;
-        }
-    } else {
-        std::cout << "[TCP] Invalid command\n";
+void request_leases() {
+    for (int a = 0; a < ATOM_COUNT && lease_fd >= 0; ++a) {
+        if (lease_pending[a] || atoms[ATOM_NAMES[a]] >= lease_low_water) continue;
+        if (!send_all(lease_fd, frame_arena.format("LEASE %s %d\n", ATOM_NAMES[a], lease_chunk))) return;
+        lease_pending[a] = true;
     }
+}
 
-    print_atoms();
+// Handles one reply line from the central bar; returns the atom bit a grant refilled.
+unsigned apply_lease_reply(std::string_view line, int* returns_acked) {
+    std::string_view words[MAX_WORDS];
+    size_t n = split_words(line, words);
+    int atom = n == 3 ? stock_key_id(words[1].data(), words[1].size()) : -1;
+    long long amount = n == 3 ? parse_number(words[2], INT_MAX) : -1;
+    if (atom < 0 || atom >= ATOM_COUNT || amount < 0) return 0;
+    if (words[0] == "RETURNED") {
+        if (returns_acked) ++*returns_acked;
+        return 0;
+    }
+    if (words[0] != "LEASED") return 0;
+    if (amount == 0) {
+        timers.schedule(now_ms() + LEASE_RETRY_MS, TIMER_LEASE_RETRY, atom);
+        return 0;
+    }
+    atoms[ATOM_NAMES[atom]] += amount;
+    leased_in[atom] += amount;
+    lease_pending[atom] = false;
+    ++inventory_version;
+    req_log() << "[LEASE] Leased " << amount << " " << ATOM_NAMES[atom] << std::endl;
+    return 1u << atom;
 }
 
-void handle_udp_command(int udp_sock) {
-    char buffer[BUFFER_SIZE];
-    sockaddr_in client_addr;
-    socklen_t addrlen = sizeof(client_addr);
+void close_lease_channel() {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, lease_fd, nullptr);
+    close(lease_fd);
+    lease_fd = -1;
+}
 
-    ssize_t len = recvfrom(udp_sock, buffer, BUFFER_SIZE - 1, 0, (sockaddr*)&client_addr, &addrlen);
-    if (len <= 0) return;
+void read_lease_stream() {
+    char buf[4096];
+    ssize_t n = recv(lease_fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) {
+        std::cerr << "[LEASE] Lost the central bar; serving from held stock only" << std::endl;
+        close_lease_channel();
+        return;
+    }
+    lease_inbuf.append(buf, n);
+    unsigned refilled = 0;
+    for (size_t nl; (nl = lease_inbuf.find('\n')) != std::string::npos; lease_inbuf.erase(0, nl + 1)) {
+        refilled |= apply_lease_reply(std::string_view(lease_inbuf.data(), nl), nullptr);
+    }
+    if (refilled) wake_waiting_orders(refilled);
+}
 
-    reset_alarm();
+// Shutdown: sends back the leased stock that is still free and waits up to a second for the
+// central bar to confirm. A grant that lands meanwhile is sent straight back too.
+void return_leases() {
+    if (lease_fd < 0) return;
+    int sent = 0, acked = 0;
+    int64_t deadline = now_ms() + 1000;
+    do {
+        for (int a = 0; a < ATOM_COUNT; ++a) {
+            int give = (int)std::min<long long>(atoms[ATOM_NAMES[a]], leased_in[a]);
+            if (give <= 0 || !send_all(lease_fd, frame_arena.format("RETURN %s %d\n", ATOM_NAMES[a], give))) continue;
+            atoms[ATOM_NAMES[a]] -= give;
+            leased_in[a] -= give;
+            ++sent;
+        }
+        pollfd pfd{lease_fd, POLLIN, 0};
+        if (acked >= sent || poll(&pfd, 1, (int)std::max<int64_t>(0, deadline - now_ms())) <= 0) break;
+        char buf[4096];
+        ssize_t n = recv(lease_fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        lease_inbuf.append(buf, n);
+        for (size_t nl; (nl = lease_inbuf.find('\n')) != std::string::npos; lease_inbuf.erase(0, nl + 1)) {
+            apply_lease_reply(std::string_view(lease_inbuf.data(), nl), &acked);
+        }
+    } while (acked < sent);
+    std::cout << "[LEASE] Returned leased stock to the central bar (" << acked << "/" << sent << " confirmed)" << std::endl;
+    close_lease_channel();
+}
 
-    buffer[len] = '\0';
-    std::string cmd(buffer);
-    std::string molecule;
-    int count = 1;
+void run_timers() {
+    timers.run_expired(now_ms(), [](const TimerEntry& timer) {
+        if (timer.kind == TIMER_WAITING_ORDER) {
+            expire_waiting_order(timer.token);
+        } else if (timer.kind == TIMER_RESERVATION && release_reservation(timer.token, false)) {
+            req_log() << "[INFO] Reservation #" << timer.token << " expired" << std::endl;
+        } else if (timer.kind == TIMER_FEED_TICK) {
+            feed_tick();
+        } else if (timer.kind == TIMER_SNAPSHOT) {
+            start_snapshot("timer");
+            timers.schedule(now_ms() + snapshot_interval_seconds * 1000LL, TIMER_SNAPSHOT, 0);
+        } else if (timer.kind == TIMER_SNAPSHOT_POLL) {
+            poll_snapshot_child();
+        } else if (timer.kind == TIMER_PEER_GOSSIP) {
+            gossip_peers();
+        } else if (timer.kind == TIMER_FORWARD) {
+            expire_forwarded_order(timer.token);
+        } else if (timer.kind == TIMER_LEASE_RETRY) {
+            lease_pending[timer.token] = false;
+        } else if (timer.kind == TIMER_IDLE_SWEEP) {
+            reap_idle_connections();
+        } else if (timer.kind == TIMER_TAKEOVER) {
+            retry_take_over((int)timer.token);
+        }
+    });
+}
 
-    std::istringstream iss(cmd);
-    std::string deliver_word;
-    iss >> deliver_word;
-    iss >> std::ws;
-    std::getline(iss, molecule);
-    molecule.erase(molecule.find_last_not_of(" \n\r\t") + 1);
+// Handles one DELIVER datagram and returns the reply ("OK n" or "FAILED", plus " TAG <n>" if
+// the order was tagged), or an empty reply when a WAIT order was parked or its shortfall
+// forwarded and will be answered later.
+std::string_view handle_deliver_request(const char* tag, TraceTransport transport, uint32_t client,
+                                        const char* buf, size_t len, int sock, const sockaddr* addr,
+                                        socklen_t addrlen) {
+    ParsedCommand cmd{};
+    size_t consumed = 0;
+    std::string_view molecule;
+    int delivered = 0;
+    bool parsed = parse_command_batch(buf, len, &cmd, 1, true, &consumed) == 1;
+    if (trace.enabled()) {
+        if (parsed) trace.record(trace.stamp(), transport, client, cmd, std::string_view(buf + cmd.offset, cmd.length));
+        else trace.record_text(transport, client, std::string_view(buf, len));
+    }
+    if (parsed && cmd.op == OP_OTHER) {
+        std::string_view reply = handle_datagram_command(tag, std::string_view(buf + cmd.offset, cmd.length));
+        if (!reply.empty()) return reply;
+    }
+    if (parsed && cmd.op == OP_DELIVER) {
+        molecule = std::string_view(buf + cmd.name_offset, cmd.name_length);
+        if (cmd.id >= 0) delivered = deliver_molecule(cmd.id, cmd.count);
+        if (cmd.id >= 0 && delivered == 0 && cmd.wait_ms > 0 && sock >= 0) {
+            park_order(tag, sock, addr, addrlen, cmd);
+            req_log() << tag << " Waiting up to " << cmd.wait_ms << " ms for " << molecule << std::endl;
+            return std::string_view();
+        }
+        if (cmd.id >= 0 && delivered < cmd.count && cmd.wait_ms == 0 && !peers.empty() && sock >= 0 &&
+            forward_shortfall(tag, sock, addr, addrlen, cmd, delivered)) {
+            print_atoms();
+            return std::string_view();
+        }
+    }
 
+    std::string_view reply;
+    if (delivered > 0) {
+        reply = frame_arena.format("OK %d", delivered);
+        req_log() << tag << " Delivered " << delivered << " of " << molecule << std::endl;
+    } else {
+        reply = "FAILED";
+        req_log() << tag << " FAILED to deliver molecule: " << molecule << std::endl;
+    }
+    print_atoms();
+    return parsed && cmd.op == OP_DELIVER ? tag_reply(reply, cmd.request_tag) : reply;
+}
 
-    size_t pos = molecule.find_last_of(" ");
-    if (pos != std::string::npos && isdigit(molecule[pos + 1])) {
-        try {
-            count = std::stoi(molecule.substr(pos + 1));
-            molecule = molecule.substr(0, pos);
-        } catch (...) {}
+// A SEQPACKET connection is answered on its own fd, which the next accept may reuse: drop
+// the replies still owed to a closed one. Peers already gave stock for forwarded orders, so
+// those finish as usual but their reply goes nowhere.
+void forget_reply_target(int fd) {
+    reply_outbox.erase(std::remove_if(reply_outbox.begin(), reply_outbox.end(),
+                                      [fd](const PendingReply& reply) { return reply.sock == fd; }),
+                       reply_outbox.end());
+    for (auto it = waiting_orders.begin(); it != waiting_orders.end();) {
+        it = it->second.sock == fd ? waiting_orders.erase(it) : std::next(it);
     }
+    for (auto& entry : forwarded_orders) {
+        if (entry.second.sock == fd) entry.second.sock = -1;
+    }
+}
 
-    int delivered = 0;
-    for (int i = 0; i < count; ++i) {
-        if (molecule == "WATER" && atoms["HYDROGEN"] >= 2 && atoms["OXYGEN"] >= 1) {
-            atoms["HYDROGEN"] -= 2;
-            atoms["OXYGEN"] -= 1;
-            molecules["WATER"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else if (molecule == "CARBON DIOXIDE" && atoms["CARBON"] >= 1 && atoms["OXYGEN"] >= 2) {
-            atoms["CARBON"] -= 1;
-            atoms["OXYGEN"] -= 2;
-            molecules["CARBON DIOXIDE"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else if (molecule == "ALCOHOL" && atoms["CARBON"] >= 2 && atoms["HYDROGEN"] >= 6 && atoms["OXYGEN"] >= 1) {
-            atoms["CARBON"] -= 2;
-            atoms["HYDROGEN"] -= 6;
-            atoms["OXYGEN"] -= 1;
-            molecules["ALCOHOL"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else if (molecule == "GLUCOSE" && atoms["CARBON"] >= 6 && atoms["HYDROGEN"] >= 12 && atoms["OXYGEN"] >= 6) {
-            atoms["CARBON"] -= 6;
-            atoms["HYDROGEN"] -= 12;
-            atoms["OXYGEN"] -= 6;
-            molecules["GLUCOSE"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
+// --idle-timeout SECONDS: a stream connection that has sent nothing for that long is shut
+// down, and the usual EOF path (on the loop or its pipeline I/O thread) closes it. Watchers
+// and subscribers only listen, and a lease holder's atoms would be stranded by the close, so
+// all of them are left alone.
+int idle_timeout_seconds = 0;
+
+void reap_idle_connections() {
+    int64_t now = now_ms(), cutoff = now - idle_timeout_seconds * 1000LL;
+    connections.for_each([now, cutoff](Connection& conn) {
+        if (conn.last_activity_ms > cutoff || subscribers.count(conn.fd)) return;
+        auto watching = watches_by_fd.find(conn.fd);
+        if (watching != watches_by_fd.end() && !watching->second.empty()) return;
+        auto leased = leases_by_fd.find(conn.fd);
+        if (leased != leases_by_fd.end() &&
+            std::any_of(leased->second.begin(), leased->second.end(), [](long long held) { return held > 0; }))
+            return;
+        req_log() << "[IDLE] Closing FD=" << conn.fd << " after " << idle_timeout_seconds << " s without input" << std::endl;
+        shutdown(conn.fd, SHUT_RDWR);
+        conn.last_activity_ms = now;  // not again before the EOF is seen
+    });
+    timers.schedule(now + 1000, TIMER_IDLE_SWEEP, 0);
+}
+
+void close_connection(Connection& conn) {
+    if (conn.kind == CONN_UDS_SEQPACKET) forget_reply_target(conn.fd);
+    remove_connection_watches(conn.fd);
+    subscribers.erase(conn.fd);
+    leases_by_fd.erase(conn.fd);
+    output_queues.erase(conn.fd);
+    if (!(conn.flags & CONN_PIPED)) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, nullptr);
+    close(conn.fd);
+    connections.remove(&conn);
+}
+
+// Applies what the --pipeline I/O threads parsed, in ring order, the way apply_add_batch
+// treats the lines of one read.
+void drain_pipeline() {
+    pipeline.clear_wake();
+    PipelineItem item;
+    unsigned added_atoms = 0;
+    bool applied = false;
+    int64_t now = now_ms();
+    uint64_t trace_ts = trace.enabled() ? trace.stamp() : 0;
+    while (pipeline.pop(item)) {
+        std::unique_ptr<char[]> long_text(pipe_long_text(item));
+        Connection* conn = connections.find_fd(item.fd);
+        if (!conn) continue;
+        if (item.kind == PIPE_CLOSED) {
+            req_log() << "[DEBUG] Pipelined client disconnected: FD=" << conn->fd << std::endl;
+            close_connection(*conn);
+            continue;
+        }
+        conn->last_activity_ms = now;
+        TraceTransport transport = trace_transport(*conn);
+        std::string_view text = pipe_text(item);
+        if (item.kind == PIPE_TEXT) {
+            if (trace.enabled()) trace.record_text(transport, conn->generation, text);
+            if (handle_stream_control(conn, text)) continue;
+            req_log() << "[PIPE] Invalid command\n";
         } else {
-            break;
+            if (trace.enabled()) {
+                ParsedCommand cmd{};
+                cmd.op = OP_ADD;
+                cmd.id = item.id;
+                cmd.count = item.count;
+                trace.record(trace_ts, transport, conn->generation, cmd, text);
+            }
+            atoms[ATOM_NAMES[item.id]] += item.count;
+            req_log() << "[PIPE] Added " << item.count << " of " << ATOM_NAMES[item.id] << std::endl;
+            added_atoms |= 1u << item.id;
+            ++inventory_version;
+        }
+        applied = true;
+        ++conn->seq;
+        if ((conn->flags & (CONN_ACK_MODE | CONN_ACK_DIRTY)) == CONN_ACK_MODE) {
+            conn->flags |= CONN_ACK_DIRTY;
+            ack_dirty.push_back(conn->fd);
         }
     }
+    if (added_atoms && !save_file_path.empty()) save_inventory_to_file(save_file_path);
+    if (added_atoms) wake_waiting_orders(added_atoms);
+    if (applied) {
+        reset_alarm();
+        print_atoms();
+    }
+}
 
-    if (delivered > 0) {
-        std::string ok = "OK " + std::to_string(delivered);
-        sendto(udp_sock, ok.c_str(), ok.size(), 0, (sockaddr*)&client_addr, addrlen);
-        std::cout << "[UDP] Delivered " << delivered << " of " << molecule << std::endl;
-    } else {
-        sendto(udp_sock, "FAILED", 6, 0, (sockaddr*)&client_addr, addrlen);
-        std::cout << "[UDP] FAILED to deliver molecule: " << molecule << std::endl;
+// --busy-poll: lets a read on an inet socket spin on the NIC queue instead of sleeping. The
+// kernel caps it at net.core.busy_read unless we have CAP_NET_ADMIN; epoll itself busy-polls
+// only with net.core.busy_poll set.
+void set_socket_busy_poll(int fd) {
+    if (busy_poll_us > 0) setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us));
+}
+
+// Drains the listener's accept queue; one wakeup can bring in a whole reconnect storm.
+void accept_connections(int listen_sock, ConnKind kind) {
+    int64_t now = now_ms();
+    while (true) {
+        int client = accept4(listen_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("[ERROR] accept4");
+            return;
+        }
+        if (kind == CONN_TCP) {
+            int one = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            set_socket_busy_poll(client);
+        }
+        if (pipeline.enabled() && kind != CONN_UDS_SEQPACKET) {
+            Connection* conn = connections.insert(client, kind, now);
+            conn->flags |= CONN_PIPED;
+            conn->io_thread = (uint8_t)pipeline.adopt(client);
+            continue;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = client;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &ev) < 0) {
+            perror("[ERROR] epoll_ctl");
+            close(client);
+            continue;
+        }
+        connections.insert(client, kind, now);
+        if (kind == CONN_TCP) req_log() << "[DEBUG] New TCP client accepted: FD=" << client << std::endl;
+        if (kind == CONN_UDS_SEQPACKET) req_log() << "[DEBUG] New SEQPACKET client accepted: FD=" << client << std::endl;
+    }
+}
+
+void handle_tcp_command(Connection& conn) {
+    req_log() << "[DEBUG] handle_tcp_command called for FD=" << conn.fd << std::endl;
+    if (!read_add_stream("[TCP]", conn)) {
+        req_log() << "[DEBUG] TCP client disconnected: FD=" << conn.fd << std::endl;
+        close_connection(conn);
     }
+}
 
-    print_atoms();
+void handle_udp_command(int udp_sock) {
+    char buffer[BUFFER_SIZE];
+    sockaddr_in client_addr;
+    socklen_t addrlen = sizeof(client_addr);
+
+    ssize_t len = recvfrom(udp_sock, buffer, BUFFER_SIZE - 1, 0, (sockaddr*)&client_addr, &addrlen);
+    if (len <= 0) return;
+
+    reset_alarm();
+
+    std::string_view reply = handle_deliver_request("[UDP]", TRACE_UDP, trace_client_id(&client_addr, addrlen), buffer, len,
+                                                    udp_sock, (sockaddr*)&client_addr, addrlen);
+    if (!reply.empty()) queue_reply(udp_sock, (sockaddr*)&client_addr, addrlen, reply);
 }
 
 void handle_console_command(const std::string& input) {
@@ -222,41 +2082,26 @@ void handle_console_command(const std::string& input) {
     } else if (input.find("GEN CHAMPAGNE") == 0) {
         int count = std::min({molecules["WATER"], molecules["CARBON DIOXIDE"], molecules["ALCOHOL"]});
         std::cout << "You can make " << count << " CHAMPAGNE(s)\n";
+    } else if (input.find("SNAPSHOT") == 0) {
+        if (snapshot_path.empty()) std::cout << "Snapshots need --snapshot <file>.\n";
+        else if (snapshot_child > 0) std::cout << "A snapshot is already running.\n";
+        else start_snapshot("console");
+    } else if (input.find("PROMOTE") == 0) {
+        if (primary_fd < 0) std::cout << "Not a standby.\n";
+        else if (!take_over("console")) std::cout << "Cannot open the client listeners (is the primary still up?); still a standby.\n";
+    } else if (input.find("INVENTORY") == 0) {
+        std::string_view words[MAX_WORDS];
+        std::cout << handle_inventory_query(words, split_words(input, words));
     } else {
         std::cout << "Unknown command.\n";
     }
 }
 
 
-void handle_uds_stream_command(int client_sock) {
-    char buffer[BUFFER_SIZE];
-    while (true) {
-        ssize_t len = recv(client_sock, buffer, BUFFER_SIZE - 1, 0);
-        if (len <= 0) break;
-
-        reset_alarm();
-
-        buffer[len] = '\0';
-        std::string type;
-        int amount;
-        char type_buf[64];
-        if (sscanf(buffer, "ADD %63s %d", type_buf, &amount) == 2) {
-            type = std::string(type_buf);
-            if (atoms.count(type)) {
-                atoms[type] += amount;
-                std::cout << "[UDS-STREAM] Added " << amount << " of " << type << std::endl;
-                if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-            } else {
-                std::cout << "[UDS-STREAM] Invalid atom type: " << type << std::endl;
-            }
-        } else {
-            std::cout << "[UDS-STREAM] Invalid command\n";
-        }
-
-        print_atoms();
+void handle_uds_stream_command(Connection& conn) {
+    if (!read_add_stream("[UDS-STREAM]", conn)) {
+        close_connection(conn);
     }
-
-    close(client_sock);
 }
 
 
@@ -269,71 +2114,270 @@ void handle_uds_dgram_command() {
 
     reset_alarm();
 
-    buffer[len] = '\0';
-    std::string cmd(buffer);
-    std::cout << "[DEBUG] Received UDS-DGRAM command: " << cmd << std::endl;
-    std::string molecule;
-    int count = 1;
-
-    std::istringstream iss(cmd);
-    std::string deliver_word;
-    iss >> deliver_word;
-    std::getline(iss, molecule);
-    molecule.erase(0, molecule.find_first_not_of(" "));
-    size_t pos = molecule.find_last_of(" ");
-    if (pos != std::string::npos && isdigit(molecule[pos + 1])) {
-        try {
-            count = std::stoi(molecule.substr(pos + 1));
-            molecule = molecule.substr(0, pos);
-        } catch (...) {}
+    req_log() << "[DEBUG] Received UDS-DGRAM command: " << std::string_view(buffer, len) << std::endl;
+    std::string_view reply = handle_deliver_request("[UDS-DGRAM]", TRACE_UDS_DGRAM, trace_client_id(&client_addr, addrlen),
+                                                    buffer, len, uds_dgram_sock, (sockaddr*)&client_addr, addrlen);
+    if (!reply.empty()) queue_reply(uds_dgram_sock, (sockaddr*)&client_addr, addrlen, reply);
+}
+
+// One line from a shared-memory channel: ADD lines are applied like stream input and
+// answered "ACK <n>", anything else is handled like a datagram. A channel has no address
+// to answer later, so WAIT orders and peer forwarding are not offered over it.
+void handle_shm_request(size_t channel, uint32_t generation, std::string_view line) {
+    if (shm_generation[channel] != generation) {
+        shm_generation[channel] = generation;
+        shm_seq[channel] = 0;
+    }
+    std::string_view reply;
+    uint32_t client = generation * SHM_CHANNELS + (uint32_t)channel;  // trace id: one per claim
+    if (line.compare(0, 4, "ADD ") == 0) {
+        apply_add_batch("[SHM]", TRACE_SHM, client, line.data(), line.size(), true, nullptr);
+        reply = frame_arena.format("ACK %u", ++shm_seq[channel]);
+    } else {
+        reply = handle_deliver_request("[SHM]", TRACE_SHM, client, line.data(), line.size(), -1,
+                                       nullptr, 0);
+        if (reply.empty()) reply = "FAILED";
+    }
+    shm_outbox.push_back({channel, generation, reply});
+}
+
+// With --shm-busy-poll or --busy-poll the loop polls the rings on every pass instead.
+bool shm_polled() { return shm.enabled() && (shm_busy_poll || busy_poll_us > 0); }
+
+void drain_shm() {
+    if (shm_polled()) {
+        shm.clear_wake();
+        return;
+    }
+    if (shm.drain(handle_shm_request) > 0) reset_alarm();
+}
+
+bool open_shm_transport() {
+    if (shm_name.empty()) return true;
+    if (!shm.create(shm_name) || !add_to_epoll(shm.wake_fd())) {
+        std::cerr << "[ERROR] Cannot open shared-memory transport " << shm_name << std::endl;
+        return false;
+    }
+    if (shm_polled()) shm.wake();
+    std::cout << "[SHM] Serving /dev/shm" << shm_object_name(shm_name) << " (" << SHM_CHANNELS << " channels"
+              << (shm_polled() ? ", polled" : "") << ")" << std::endl;
+    return true;
+}
+
+// --seqpacket-path: one message is one command. ADD and the stream control commands work as
+// on a stream connection (ACK ON for cumulative acks); DELIVER and the other datagram
+// commands are answered on the connection, in order, with no client socket file needed.
+void handle_seqpacket_message(Connection& conn) {
+    char buffer[BUFFER_SIZE];
+    // MSG_TRUNC returns the full message length, so an oversized one is refused, not cut.
+    ssize_t len = recv(conn.fd, buffer, sizeof(buffer), MSG_DONTWAIT | MSG_TRUNC);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (len <= 0) {
+        req_log() << "[DEBUG] SEQPACKET client disconnected: FD=" << conn.fd << std::endl;
+        close_connection(conn);
+        return;
+    }
+    reset_alarm();
+    conn.last_activity_ms = now_ms();
+
+    sockaddr_storage connected{};  // replies go out on the connection, so no address
+    if ((size_t)len > sizeof(buffer)) {
+        req_log() << "[SEQPACKET] FD=" << conn.fd << " sent a " << len << "-byte message (limit " << sizeof(buffer) << ")" << std::endl;
+        queue_reply(conn.fd, (sockaddr*)&connected, 0, "FAILED");
+        return;
+    }
+    ParsedCommand cmd{};
+    size_t consumed = 0;
+    bool parsed = parse_command_batch(buffer, len, &cmd, 1, true, &consumed) == 1;
+    if (parsed && cmd.op == OP_ADD) {
+        apply_add_batch("[SEQPACKET]", TRACE_SEQPACKET, conn.generation, buffer, len, true, &conn);
+        return;
+    }
+    std::string_view line(buffer + cmd.offset, cmd.length);
+    if (parsed && cmd.op == OP_OTHER && handle_stream_control(&conn, line)) {
+        if (trace.enabled()) trace.record_text(TRACE_SEQPACKET, conn.generation, line);
+        return;
     }
+    std::string_view reply = handle_deliver_request("[SEQPACKET]", TRACE_SEQPACKET, conn.generation, buffer, len, conn.fd,
+                                                    (sockaddr*)&connected, 0);
+    if (!reply.empty()) queue_reply(conn.fd, (sockaddr*)&connected, 0, reply);
+}
 
-    int delivered = 0;
-    for (int i = 0; i < count; ++i) {
-        if (molecule == "WATER" && atoms["HYDROGEN"] >= 2 && atoms["OXYGEN"] >= 1) {
-            atoms["HYDROGEN"] -= 2;
-            atoms["OXYGEN"] -= 1;
-            molecules["WATER"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else if (molecule == "CARBON DIOXIDE" && atoms["CARBON"] >= 1 && atoms["OXYGEN"] >= 2) {
-            atoms["CARBON"] -= 1;
-            atoms["OXYGEN"] -= 2;
-            molecules["CARBON DIOXIDE"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else if (molecule == "ALCOHOL" && atoms["CARBON"] >= 2 && atoms["HYDROGEN"] >= 6 && atoms["OXYGEN"] >= 1) {
-            atoms["CARBON"] -= 2;
-            atoms["HYDROGEN"] -= 6;
-            atoms["OXYGEN"] -= 1;
-            molecules["ALCOHOL"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else if (molecule == "GLUCOSE" && atoms["CARBON"] >= 6 && atoms["HYDROGEN"] >= 12 && atoms["OXYGEN"] >= 6) {
-            atoms["CARBON"] -= 6;
-            atoms["HYDROGEN"] -= 12;
-            atoms["OXYGEN"] -= 6;
-            molecules["GLUCOSE"]++;
-            delivered++;
-            if (!save_file_path.empty()) save_inventory_to_file(save_file_path);
-        } else {
-            break;
+// Binds the client listeners (and the replication listener, if configured) and adds them to
+// epoll. A standby calls this only when it takes over.
+bool open_listeners() {
+    // TCP
+    tcp_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(tcp_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (defer_accept_seconds > 0) {
+        setsockopt(tcp_sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept_seconds, sizeof(defer_accept_seconds));
+    }
+    sockaddr_in tcp_addr{};
+    tcp_addr.sin_family = AF_INET;
+    tcp_addr.sin_port = htons(tcp_port);
+    tcp_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(tcp_sock, (sockaddr*)&tcp_addr, sizeof(tcp_addr)) < 0 || listen(tcp_sock, listen_backlog) < 0) {
+        perror("[ERROR] TCP listener");
+        return false;
+    }
+
+    // UDP. No SO_REUSEADDR: Linux would let a second bar bind the port and split the
+    // datagrams between the two.
+    udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in udp_addr{};
+    udp_addr.sin_family = AF_INET;
+    udp_addr.sin_port = htons(udp_port);
+    udp_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(udp_sock, (sockaddr*)&udp_addr, sizeof(udp_addr)) < 0) {
+        perror("[ERROR] UDP bind");
+        return false;
+    }
+    set_socket_busy_poll(udp_sock);
+
+    // UDS STREAM
+    if (!uds_stream_path.empty()) {
+        uds_stream_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_un stream_addr{};
+        stream_addr.sun_family = AF_UNIX;
+        strncpy(stream_addr.sun_path, uds_stream_path.c_str(), sizeof(stream_addr.sun_path) - 1);
+        unlink(stream_addr.sun_path);
+        if (bind(uds_stream_sock, (sockaddr*)&stream_addr, sizeof(stream_addr)) < 0 ||
+            listen(uds_stream_sock, listen_backlog) < 0) {
+            perror("[ERROR] UDS stream listener");
+            return false;
         }
     }
 
-    if (delivered > 0) {
-        std::string ok = "OK " + std::to_string(delivered);
-        sendto(uds_dgram_sock, ok.c_str(), ok.size(), 0, (sockaddr*)&client_addr, addrlen);
-        std::cout << "[UDS-DGRAM] Delivered " << delivered << " of " << molecule << std::endl;
-    } else {
-        sendto(uds_dgram_sock, "FAILED", 6, 0, (sockaddr*)&client_addr, addrlen);
-        std::cout << "[UDS-DGRAM] FAILED to deliver molecule: " << molecule << std::endl;
+    // UDS DGRAM
+    if (!uds_dgram_path.empty()) {
+        uds_dgram_sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+        sockaddr_un dgram_addr{};
+        dgram_addr.sun_family = AF_UNIX;
+        strncpy(dgram_addr.sun_path, uds_dgram_path.c_str(), sizeof(dgram_addr.sun_path) - 1);
+        unlink(dgram_addr.sun_path);
+        if (bind(uds_dgram_sock, (sockaddr*)&dgram_addr, sizeof(dgram_addr)) < 0) {
+            perror("[ERROR] UDS datagram bind");
+            return false;
+        }
+    }
+
+    // UDS SEQPACKET
+    if (!uds_seqpacket_path.empty()) {
+        uds_seqpacket_sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_un seq_addr{};
+        seq_addr.sun_family = AF_UNIX;
+        strncpy(seq_addr.sun_path, uds_seqpacket_path.c_str(), sizeof(seq_addr.sun_path) - 1);
+        unlink(seq_addr.sun_path);
+        if (bind(uds_seqpacket_sock, (sockaddr*)&seq_addr, sizeof(seq_addr)) < 0 ||
+            listen(uds_seqpacket_sock, listen_backlog) < 0) {
+            perror("[ERROR] UDS seqpacket listener");
+            return false;
+        }
+    }
+
+    // Replication (standbys connect here)
+    if (replication_port >= 0) {
+        replication_tcp_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        setsockopt(replication_tcp_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in repl_addr{};
+        repl_addr.sin_family = AF_INET;
+        repl_addr.sin_port = htons(replication_port);
+        repl_addr.sin_addr.s_addr = INADDR_ANY;
+        if (bind(replication_tcp_sock, (sockaddr*)&repl_addr, sizeof(repl_addr)) < 0 ||
+            listen(replication_tcp_sock, 8) < 0) {
+            perror("[ERROR] replication listener");
+            return false;
+        }
+    }
+    if (!replication_path.empty()) {
+        replication_uds_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un repl_addr{};
+        repl_addr.sun_family = AF_UNIX;
+        strncpy(repl_addr.sun_path, replication_path.c_str(), sizeof(repl_addr.sun_path) - 1);
+        unlink(repl_addr.sun_path);
+        if (bind(replication_uds_sock, (sockaddr*)&repl_addr, sizeof(repl_addr)) < 0 ||
+            listen(replication_uds_sock, 8) < 0) {
+            perror("[ERROR] replication listener");
+            return false;
+        }
+    }
+
+    for (int fd : {tcp_sock, udp_sock, uds_stream_sock, uds_dgram_sock, uds_seqpacket_sock, replication_tcp_sock,
+                   replication_uds_sock}) {
+        if (fd != -1 && !add_to_epoll(fd)) {
+            perror("epoll_ctl");
+            return false;
+        }
+    }
+    return true;
+}
+
+void close_listeners() {
+    for (int* fd : {&tcp_sock, &udp_sock, &uds_stream_sock, &uds_dgram_sock, &uds_seqpacket_sock, &replication_tcp_sock,
+                    &replication_uds_sock}) {
+        if (*fd == -1) continue;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, *fd, nullptr);
+        close(*fd);
+        *fd = -1;
     }
-    print_atoms();
 }
 
+// "2,3" or "2-5,8" -> CPU numbers; false on anything else.
+bool parse_cpu_list(const char* text, std::vector<int>& cpus) {
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        size_t dash = item.find('-');
+        long long first = parse_number(std::string_view(item).substr(0, dash), CPU_SETSIZE - 1);
+        long long last = dash == std::string::npos ? first : parse_number(std::string_view(item).substr(dash + 1), CPU_SETSIZE - 1);
+        if (first < 0 || last < first) return false;
+        for (long long cpu = first; cpu <= last; ++cpu) cpus.push_back((int)cpu);
+    }
+    return !cpus.empty();
+}
+
+bool pin_thread(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0) {
+        errno = err;
+        perror("[ERROR] pthread_setaffinity_np");
+    }
+    return err == 0;
+}
+
+// Long-only options.
+enum {
+    OPT_BACKLOG = 1000,
+    OPT_DEFER_ACCEPT,
+    OPT_QUIET,
+    OPT_TRACE,
+    OPT_SNAPSHOT,
+    OPT_SNAPSHOT_INTERVAL,
+    OPT_SNAPSHOT_LOG_BYTES,
+    OPT_REPLICATION_PORT,
+    OPT_REPLICATION_PATH,
+    OPT_STANDBY_OF,
+    OPT_SYNC_REPLICATION,
+    OPT_SYNC_TIMEOUT,
+    OPT_PEER,
+    OPT_PEER_TIMEOUT,
+    OPT_LEASE_FROM,
+    OPT_LEASE_CHUNK,
+    OPT_LEASE_LOW_WATER,
+    OPT_PIPELINE,
+    OPT_SHM_BUSY_POLL,
+    OPT_SEQPACKET_PATH,
+    OPT_BUSY_POLL,
+    OPT_CPUS,
+    OPT_IDLE_TIMEOUT,
+};
+
 int main(int argc, char* argv[]) {
-    int tcp_port = -1, udp_port = -1;
+    std::vector<std::string> peer_specs;
     int opt;
 
     static struct option long_options[] = {
@@ -346,10 +2390,34 @@ int main(int argc, char* argv[]) {
         {"stream-path", required_argument, nullptr, 's'},
         {"datagram-path", required_argument, nullptr, 'd'},
         {"save-file", required_argument, nullptr, 'f'},  // ✅ רק אחת!
+        {"backlog", required_argument, nullptr, OPT_BACKLOG},
+        {"defer-accept", required_argument, nullptr, OPT_DEFER_ACCEPT},
+        {"quiet", no_argument, nullptr, OPT_QUIET},
+        {"trace", required_argument, nullptr, OPT_TRACE},
+        {"snapshot", required_argument, nullptr, OPT_SNAPSHOT},
+        {"snapshot-interval", required_argument, nullptr, OPT_SNAPSHOT_INTERVAL},
+        {"snapshot-log-bytes", required_argument, nullptr, OPT_SNAPSHOT_LOG_BYTES},
+        {"replication-port", required_argument, nullptr, OPT_REPLICATION_PORT},
+        {"replication-path", required_argument, nullptr, OPT_REPLICATION_PATH},
+        {"standby-of", required_argument, nullptr, OPT_STANDBY_OF},
+        {"sync-replication", no_argument, nullptr, OPT_SYNC_REPLICATION},
+        {"sync-timeout", required_argument, nullptr, OPT_SYNC_TIMEOUT},
+        {"peer", required_argument, nullptr, OPT_PEER},
+        {"peer-timeout", required_argument, nullptr, OPT_PEER_TIMEOUT},
+        {"lease-from", required_argument, nullptr, OPT_LEASE_FROM},
+        {"lease-chunk", required_argument, nullptr, OPT_LEASE_CHUNK},
+        {"lease-low-water", required_argument, nullptr, OPT_LEASE_LOW_WATER},
+        {"pipeline", required_argument, nullptr, OPT_PIPELINE},
+        {"shm-name", required_argument, nullptr, 'm'},
+        {"shm-busy-poll", no_argument, nullptr, OPT_SHM_BUSY_POLL},
+        {"seqpacket-path", required_argument, nullptr, OPT_SEQPACKET_PATH},
+        {"busy-poll", required_argument, nullptr, OPT_BUSY_POLL},
+        {"cpus", required_argument, nullptr, OPT_CPUS},
+        {"idle-timeout", required_argument, nullptr, OPT_IDLE_TIMEOUT},
         {nullptr, 0, nullptr, 0}
     };    
 
-    while ((opt = getopt_long(argc, argv, "t:T:U:o:c:h:s:d:f:", long_options, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:T:U:o:c:h:s:d:f:m:", long_options, nullptr)) != -1) {
         switch (opt) {
             case 'f':
             save_file_path = optarg;
@@ -362,9 +2430,50 @@ int main(int argc, char* argv[]) {
             case 'h': atoms["HYDROGEN"] = std::atoi(optarg); break;
             case 's': uds_stream_path = optarg; break;
             case 'd': uds_dgram_path = optarg; break;
+            case 'm': shm_name = optarg; break;
+            case OPT_BACKLOG: listen_backlog = std::atoi(optarg); break;
+            case OPT_DEFER_ACCEPT: defer_accept_seconds = std::atoi(optarg); break;
+            case OPT_QUIET: quiet = true; break;
+            case OPT_TRACE:
+                if (!trace.open(optarg)) {
+                    perror("[ERROR] trace file");
+                    return 1;
+                }
+                break;
+            case OPT_SNAPSHOT: snapshot_path = optarg; break;
+            case OPT_SNAPSHOT_INTERVAL: snapshot_interval_seconds = std::atoi(optarg); break;
+            case OPT_SNAPSHOT_LOG_BYTES: snapshot_log_limit = std::atoll(optarg); break;
+            case OPT_REPLICATION_PORT: replication_port = std::atoi(optarg); break;
+            case OPT_REPLICATION_PATH: replication_path = optarg; break;
+            case OPT_STANDBY_OF: standby_of = optarg; break;
+            case OPT_SYNC_REPLICATION: sync_replication = true; break;
+            case OPT_SYNC_TIMEOUT: sync_timeout_ms = std::atoi(optarg); break;
+            case OPT_PEER: peer_specs.push_back(optarg); break;
+            case OPT_PEER_TIMEOUT: peer_timeout_ms = std::atoi(optarg); break;
+            case OPT_LEASE_FROM: lease_from = optarg; break;
+            case OPT_LEASE_CHUNK: lease_chunk = std::atoi(optarg); break;
+            case OPT_LEASE_LOW_WATER: lease_low_water = std::atoi(optarg); break;
+            case OPT_PIPELINE: pipeline_threads = std::min(std::atoi(optarg), 255); break;
+            case OPT_SHM_BUSY_POLL: shm_busy_poll = true; break;
+            case OPT_SEQPACKET_PATH: uds_seqpacket_path = optarg; break;
+            case OPT_BUSY_POLL: busy_poll_us = std::max(0, std::atoi(optarg)); break;
+            case OPT_IDLE_TIMEOUT: idle_timeout_seconds = std::max(0, std::atoi(optarg)); break;
+            case OPT_CPUS:
+                if (!parse_cpu_list(optarg, loop_cpus)) {
+                    std::cerr << "Invalid CPU list: " << optarg << "\n";
+                    return 1;
+                }
+                break;
             default:
                 std::cerr << "Usage: " << argv[0]
-                          << " -T <tcp_port> -U <udp_port> [-t timeout] [-o O] [-c C] [-h H] [-s stream_path] [-d dgram_path] [-f save_file]\n";
+                          << " -T <tcp_port> -U <udp_port> [-t timeout] [-o O] [-c C] [-h H] [-s stream_path] [-d dgram_path] [-f save_file]"
+                          << " [--backlog N] [--defer-accept SECONDS] [--quiet] [--trace file]"
+                          << " [--snapshot file [--snapshot-interval SECONDS] [--snapshot-log-bytes N]]"
+                          << " [--replication-port P] [--replication-path path] [--sync-replication [--sync-timeout MS]]"
+                          << " [--standby-of host:port|path] [--peer host:udp_port ... [--peer-timeout MS]]"
+                          << " [--lease-from host:port|path [--lease-chunk N] [--lease-low-water N]]"
+                          << " [--pipeline IO_THREADS] [-m shm_name [--shm-busy-poll]] [--seqpacket-path path]"
+                          << " [--busy-poll USEC] [--cpus LIST] [--idle-timeout SECONDS]\n";
                 return 1;
         }
     }
@@ -376,124 +2485,168 @@ int main(int argc, char* argv[]) {
         }
     }
     
-    signal(SIGALRM, timeout_handler);
-    signal(SIGINT, handle_sigint);
-    reset_alarm();
-
-    // TCP
-    int tcp_sock = socket(AF_INET, SOCK_STREAM, 0);
-    sockaddr_in tcp_addr{};
-    tcp_addr.sin_family = AF_INET;
-    tcp_addr.sin_port = htons(tcp_port);
-    tcp_addr.sin_addr.s_addr = INADDR_ANY;
-    bind(tcp_sock, (sockaddr*)&tcp_addr, sizeof(tcp_addr));
-    listen(tcp_sock, 5);
-
-    // UDP
-    int udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
-    sockaddr_in udp_addr{};
-    udp_addr.sin_family = AF_INET;
-    udp_addr.sin_port = htons(udp_port);
-    udp_addr.sin_addr.s_addr = INADDR_ANY;
-    bind(udp_sock, (sockaddr*)&udp_addr, sizeof(udp_addr));
+    if (!snapshot_path.empty() && !open_snapshot_store()) return 1;
 
-    // UDS STREAM
-    if (!uds_stream_path.empty()) {
-        uds_stream_sock = socket(AF_UNIX, SOCK_STREAM, 0);
-        sockaddr_un stream_addr{};
-        stream_addr.sun_family = AF_UNIX;
-        strncpy(stream_addr.sun_path, uds_stream_path.c_str(), sizeof(stream_addr.sun_path) - 1);
-        unlink(stream_addr.sun_path);
-        bind(uds_stream_sock, (sockaddr*)&stream_addr, sizeof(stream_addr));
-        listen(uds_stream_sock, 5);
+    stop_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd = epoll_create1(0);
+    if (stop_event_fd < 0 || epoll_fd < 0 || !add_to_epoll(stop_event_fd)) {
+        perror("epoll_create1");
+        return 1;
     }
+    signal(SIGALRM, handle_stop_signal);
+    signal(SIGINT, handle_stop_signal);
+    build_wakeup_index();
+    reset_alarm();
 
-    // UDS DGRAM
-    if (!uds_dgram_path.empty()) {
-        uds_dgram_sock = socket(AF_UNIX, SOCK_DGRAM, 0);
-        sockaddr_un dgram_addr{};
-        dgram_addr.sun_family = AF_UNIX;
-        strncpy(dgram_addr.sun_path, uds_dgram_path.c_str(), sizeof(dgram_addr.sun_path) - 1);
-        unlink(dgram_addr.sun_path);
-        bind(uds_dgram_sock, (sockaddr*)&dgram_addr, sizeof(dgram_addr));
-    }
+    // stdin may be a regular file or /dev/null, which epoll refuses; run without a console then.
+    add_to_epoll(STDIN_FILENO);
 
-    std::cout << "Atom Warehouse (Stage 6) started.\n";
+    if (!standby_of.empty()) {
+        if (!connect_to_primary()) return 1;
+        std::cout << "Atom Warehouse (Stage 6) started as standby of " << standby_of << ".\n";
+    } else {
+        if (!open_listeners() || !open_shm_transport()) return 1;
+        std::cout << "Atom Warehouse (Stage 6) started.\n";
+    }
     print_atoms();
 
-    while (true) {
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(STDIN_FILENO, &read_fds);
-        FD_SET(tcp_sock, &read_fds);
-        FD_SET(udp_sock, &read_fds);
-        if (uds_stream_sock != -1) FD_SET(uds_stream_sock, &read_fds);
-        if (uds_dgram_sock != -1) FD_SET(uds_dgram_sock, &read_fds);
-        int max_fd = std::max({STDIN_FILENO, tcp_sock, udp_sock, uds_stream_sock, uds_dgram_sock});
-
-        for (int client : tcp_clients) {
-            FD_SET(client, &read_fds);
-            max_fd = std::max(max_fd, client);
-        }
-
-        int activity = select(max_fd + 1, &read_fds, nullptr, nullptr, nullptr);
-        if (activity < 0) {
-            perror("select");
-            break;
+    if (pipeline_threads > 0) {
+        if (!pipeline.start(pipeline_threads) || !add_to_epoll(pipeline.wake_fd())) {
+            perror("[ERROR] pipeline");
+            return 1;
         }
+        std::cout << "[PIPE] " << pipeline_threads << " I/O thread(s) parse stream input" << std::endl;
+    }
+    for (const std::string& spec : peer_specs) {
+        if (!connect_peer(spec)) return 1;
+    }
+    if (!peers.empty()) gossip_peers();
+    if (idle_timeout_seconds > 0) timers.schedule(now_ms() + 1000, TIMER_IDLE_SWEEP, 0);
+    if (!lease_from.empty()) {
+        lease_fd = connect_stream(lease_from, "central bar");
+        if (lease_fd < 0) return 1;
+        if (lease_low_water < 0) lease_low_water = lease_chunk / 4;
+        request_leases();
+    }
 
-        if (FD_ISSET(STDIN_FILENO, &read_fds)) {
-            char input[256];
-            if (fgets(input, sizeof(input), stdin)) {
-                std::string command(input);
-                command.erase(std::remove(command.begin(), command.end(), '\n'), command.end());
-                command.erase(0, command.find_first_not_of(" \t"));
-                command.erase(command.find_last_not_of(" \t") + 1);
-                std::transform(command.begin(), command.end(), command.begin(), ::toupper);
-                handle_console_command(command);
-                reset_alarm();
-            }
+    if (!loop_cpus.empty()) {
+        sched_getaffinity(0, sizeof(startup_cpus), &startup_cpus);
+        if (!pin_thread(pthread_self(), loop_cpus[0])) return 1;
+        for (size_t i = 0; loop_cpus.size() > 1 && i < pipeline.io_threads(); ++i) {
+            pin_thread(pipeline.io_handle(i), loop_cpus[1 + i % (loop_cpus.size() - 1)]);
         }
-        
-
-        if (FD_ISSET(tcp_sock, &read_fds)) {
-            int new_client = accept(tcp_sock, nullptr, nullptr);
-            if (new_client >= 0) {
-                std::cout << "[DEBUG] New TCP client accepted: FD=" << new_client << std::endl;
-                tcp_clients.push_back(new_client);
-            } else {
-                perror("[ERROR] accept");
-            }
+        std::cout << "[BUSY] Event loop pinned to CPU " << loop_cpus[0] << std::endl;
+    }
+    if (busy_poll_us > 0) {
+        std::cout << "[BUSY] Polling for " << busy_poll_us << " us after each event" << std::endl;
+        if (std::thread::hardware_concurrency() <= 1) {
+            std::cerr << "[BUSY] Only one CPU: spinning takes it from the clients and adds latency" << std::endl;
         }
-        
+    }
 
-        if (FD_ISSET(udp_sock, &read_fds)) {
-            handle_udp_command(udp_sock);
-        }
+    epoll_event events[64];
+    int64_t spin_until_us = 0;
+    while (!stop_signal) {
+        frame_arena.reset();
 
-        for (int client : tcp_clients) {
-            if (FD_ISSET(client, &read_fds)) {
-                handle_tcp_command(client);
-            }
+        // Idle passes while spinning cost one epoll_wait and a vDSO clock read, nothing else.
+        bool spinning = (shm_busy_poll && shm.enabled()) || (busy_poll_us > 0 && now_us() < spin_until_us);
+        int timeout = spinning ? 0 : timers.timeout_ms(now_ms());
+        if (timeout != 0 && shm_polled() && !shm.sleep()) timeout = 0;
+        int ready = epoll_wait(epoll_fd, events, 64, timeout);
+        if (timeout != 0 && shm_polled()) shm.wake();
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
         }
 
-        if (uds_stream_sock != -1 && FD_ISSET(uds_stream_sock, &read_fds)) {
-            int uds_client = accept(uds_stream_sock, nullptr, nullptr);
-            if (uds_client >= 0) {
-                handle_uds_stream_command(uds_client);
-                close(uds_client);
+        // Accept after the client events so a freshly reused fd never sees a stale event.
+        bool accept_tcp = false, accept_uds = false, accept_seqpacket = false;
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == STDIN_FILENO) {
+                char input[256];
+                if (fgets(input, sizeof(input), stdin)) {
+                    std::string command(input);
+                    command.erase(std::remove(command.begin(), command.end(), '\n'), command.end());
+                    command.erase(0, command.find_first_not_of(" \t"));
+                    command.erase(command.find_last_not_of(" \t") + 1);
+                    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+                    if (trace.enabled()) trace.record_text(TRACE_CONSOLE, 0, command);
+                    handle_console_command(command);
+                    reset_alarm();
+                } else {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+                }
+            } else if (fd == tcp_sock) {
+                accept_tcp = true;
+            } else if (fd == uds_stream_sock) {
+                accept_uds = true;
+            } else if (fd == uds_seqpacket_sock) {
+                accept_seqpacket = true;
+            } else if (fd == udp_sock) {
+                handle_udp_command(udp_sock);
+            } else if (fd == uds_dgram_sock) {
+                handle_uds_dgram_command();
+            } else if (fd == replication_tcp_sock || fd == replication_uds_sock) {
+                accept_replica(fd);
+            } else if (fd == primary_fd) {
+                read_primary_stream();
+            } else if (Replica* replica = find_replica(fd)) {
+                if (!service_replica(*replica, events[i].events)) drop_replica(*replica);
+            } else if (fd == pipeline.wake_fd()) {
+                drain_pipeline();
+            } else if (fd == shm.wake_fd()) {
+                drain_shm();
+            } else if (fd == lease_fd) {
+                read_lease_stream();
+            } else if (Peer* peer = find_peer(fd)) {
+                read_peer_replies(*peer);
+            } else if (Connection* conn = connections.find_fd(fd)) {
+                if (events[i].events & EPOLLOUT) flush_output(*conn, output_queues[fd]);
+                if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+                if (conn->kind == CONN_TCP) handle_tcp_command(*conn);
+                else if (conn->kind == CONN_UDS_SEQPACKET) handle_seqpacket_message(*conn);
+                else handle_uds_stream_command(*conn);
             }
         }
-
-        if (uds_dgram_sock != -1 && FD_ISSET(uds_dgram_sock, &read_fds)) {
-            handle_uds_dgram_command();
-        }
+        size_t shm_handled = shm_polled() ? shm.poll(handle_shm_request) : 0;
+        if (shm_handled > 0) reset_alarm();
+        if (busy_poll_us > 0 && (ready > 0 || shm_handled > 0)) spin_until_us = now_us() + busy_poll_us;
+        run_timers();
+        notify_watches();
+        if (lease_fd >= 0) request_leases();
+        persist_iteration();
+        replicate_iteration();
+        flush_replies();
+        flush_acks();
+        if (accept_tcp) accept_connections(tcp_sock, CONN_TCP);
+        if (accept_uds) accept_connections(uds_stream_sock, CONN_UDS_STREAM);
+        if (accept_seqpacket) accept_connections(uds_seqpacket_sock, CONN_UDS_SEQPACKET);
     }
 
+    if (stop_signal == SIGALRM) {
+        std::cout << "\n[TIMEOUT] No activity received within " << timeout_seconds << " seconds. Shutting down.\n";
+    } else if (stop_signal == SIGINT) {
+        std::cout << "\n[EXIT] Caught Ctrl+C, saving inventory..." << std::endl;
+    }
+    return_leases();
+    flush_mutation_log();
     if (!save_file_path.empty()) {
         save_inventory_to_file(save_file_path);
     }
 
+    if (trace.enabled()) {
+        trace.close();
+        if (trace.dropped()) std::cerr << "[TRACE] Dropped " << trace.dropped() << " records (ring full)" << std::endl;
+    }
+
+    pipeline.stop();
+    shm.destroy();
+    connections.for_each([](Connection& conn) { close_connection(conn); });
+    close(epoll_fd);
+    close(stop_event_fd);
     close(tcp_sock);
     close(udp_sock);
     if (uds_stream_sock != -1) {
@@ -504,6 +2657,10 @@ int main(int argc, char* argv[]) {
         close(uds_dgram_sock);
         unlink(uds_dgram_path.c_str());
     }
+    if (uds_seqpacket_sock != -1) {
+        close(uds_seqpacket_sock);
+        unlink(uds_seqpacket_path.c_str());
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+// File: inventory_schema.hpp
+// Description: Atom / molecule / drink names and recipes shared by the bar and its tools
+
+#pragma once
+
+#include <cstring>
+
+enum AtomId { ATOM_CARBON, ATOM_HYDROGEN, ATOM_OXYGEN, ATOM_COUNT };
+enum MoleculeId { MOL_WATER, MOL_CARBON_DIOXIDE, MOL_ALCOHOL, MOL_GLUCOSE, MOL_COUNT };
+enum DrinkId { DRINK_SOFT_DRINK, DRINK_VODKA, DRINK_CHAMPAGNE, DRINK_COUNT };
+
+// Same order as the std::map in drinks_bar, so ids and iteration order agree.
+inline const char* const ATOM_NAMES[ATOM_COUNT] = {"CARBON", "HYDROGEN", "OXYGEN"};
+inline const char* const MOLECULE_NAMES[MOL_COUNT] = {"WATER", "CARBON DIOXIDE", "ALCOHOL", "GLUCOSE"};
+inline const char* const DRINK_NAMES[DRINK_COUNT] = {"SOFT DRINK", "VODKA", "CHAMPAGNE"};
+
+// Atoms consumed by one unit of each molecule, indexed by AtomId.
+inline const int MOLECULE_RECIPES[MOL_COUNT][ATOM_COUNT] = {
+    /* WATER          */ {0, 2, 1},
+    /* CARBON DIOXIDE */ {1, 0, 2},
+    /* ALCOHOL        */ {2, 6, 1},
+    /* GLUCOSE        */ {6, 12, 6},
+};
+
+// Molecules combined into one drink (one of each).
+inline const MoleculeId DRINK_RECIPES[DRINK_COUNT][3] = {
+    /* SOFT DRINK */ {MOL_WATER, MOL_CARBON_DIOXIDE, MOL_GLUCOSE},
+    /* VODKA      */ {MOL_WATER, MOL_ALCOHOL, MOL_GLUCOSE},
+    /* CHAMPAGNE  */ {MOL_WATER, MOL_CARBON_DIOXIDE, MOL_ALCOHOL},
+};
+
+template <int N>
+inline int lookup_name(const char* const (&names)[N], const char* s, size_t len) {
+    for (int i = 0; i < N; ++i) {
+        if (std::strlen(names[i]) == len && std::memcmp(names[i], s, len) == 0) return i;
+    }
+    return -1;
+}
+
+inline int atom_id(const char* s, size_t len) { return lookup_name(ATOM_NAMES, s, len); }
+inline int molecule_id(const char* s, size_t len) { return lookup_name(MOLECULE_NAMES, s, len); }
+inline int drink_id(const char* s, size_t len) { return lookup_name(DRINK_NAMES, s, len); }
+
+// Stock keys name every watchable level in one index space: atoms, then molecules, then drinks.
+constexpr int STOCK_KEY_COUNT = ATOM_COUNT + MOL_COUNT + DRINK_COUNT;
+
+inline const char* stock_key_name(int key) {
+    if (key < ATOM_COUNT) return ATOM_NAMES[key];
+    if (key < ATOM_COUNT + MOL_COUNT) return MOLECULE_NAMES[key - ATOM_COUNT];
+    return DRINK_NAMES[key - ATOM_COUNT - MOL_COUNT];
+}
+
+inline int stock_key_id(const char* s, size_t len) {
+    int id = atom_id(s, len);
+    if (id >= 0) return id;
+    if ((id = molecule_id(s, len)) >= 0) return ATOM_COUNT + id;
+    if ((id = drink_id(s, len)) >= 0) return ATOM_COUNT + MOL_COUNT + id;
+    return -1;
+}
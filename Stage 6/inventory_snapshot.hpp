@@ -0,0 +1,145 @@
+// File: inventory_snapshot.hpp
+// Description: Binary inventory snapshot written by drinks_bar's forked snapshot child and
+//              by inventory_tool, and mmap'd and validated in place at startup.
+//
+//   File := SnapshotHeader SnapshotEntry[entry_count]
+//   Entries are keyed by name, so a snapshot survives changes to the schema's enum order.
+//   checksum is FNV-1a 64 over the header (with checksum = 0) and then the entries.
+//   The writer only uses open/write/fsync/rename, so it is safe to call in a forked child.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+constexpr char SNAPSHOT_MAGIC[8] = {'D', 'B', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr uint32_t SNAPSHOT_FORMAT = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t entry_count;
+    uint64_t inventory_version;  // the bar's inventory_version when the snapshot was taken
+    uint32_t entry_size;
+    uint32_t reserved;
+    uint64_t checksum;
+};
+static_assert(sizeof(SnapshotHeader) == 40, "snapshot headers are written as raw bytes");
+
+struct SnapshotEntry {
+    char name[24];  // NUL-padded stock key name
+    int64_t level;
+};
+static_assert(sizeof(SnapshotEntry) == 32, "snapshot entries are written as raw bytes");
+
+inline uint64_t snapshot_fnv1a(const void* data, size_t len, uint64_t h = 14695981039346656037ull) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+inline uint64_t snapshot_checksum(const SnapshotHeader& header, const SnapshotEntry* entries) {
+    SnapshotHeader unsummed = header;
+    unsummed.checksum = 0;
+    uint64_t h = snapshot_fnv1a(&unsummed, sizeof(unsummed));
+    return snapshot_fnv1a(entries, sizeof(SnapshotEntry) * header.entry_count, h);
+}
+
+inline bool write_all(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Writes tmp_path, syncs it and renames it over path, so readers only ever see a whole file.
+inline bool write_snapshot(const char* path, const char* tmp_path, uint64_t version, const SnapshotEntry* entries,
+                           uint32_t count) {
+    int fd = ::open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.format = SNAPSHOT_FORMAT;
+    header.entry_count = count;
+    header.inventory_version = version;
+    header.entry_size = sizeof(SnapshotEntry);
+    header.checksum = snapshot_checksum(header, entries);
+    bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, entries, sizeof(SnapshotEntry) * count) &&
+              fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    return ok && ::rename(tmp_path, path) == 0;
+}
+
+// Read-only mapping of a snapshot file. open() checks the magic, format, sizes and checksum
+// against the mapped bytes; entries() then points straight into the mapping.
+class SnapshotView {
+public:
+    SnapshotView() = default;
+    SnapshotView(const SnapshotView&) = delete;
+    SnapshotView& operator=(const SnapshotView&) = delete;
+    ~SnapshotView() { close(); }
+
+    // Returns false with error() set if the file is missing, unreadable or fails validation.
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return fail("cannot open");
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+            ::close(fd);
+            return fail("too short");
+        }
+        size_ = st.st_size;
+        void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) return fail("mmap failed");
+        base_ = static_cast<const char*>(map);
+
+        std::memcpy(&header_, base_, sizeof(SnapshotHeader));
+        if (std::memcmp(header_.magic, SNAPSHOT_MAGIC, sizeof(header_.magic)) != 0) return fail("bad magic");
+        if (header_.format != SNAPSHOT_FORMAT) return fail("unsupported format");
+        if (header_.entry_size != sizeof(SnapshotEntry)) return fail("unsupported entry size");
+        if (size_ != sizeof(SnapshotHeader) + (size_t)header_.entry_count * sizeof(SnapshotEntry)) return fail("size mismatch");
+        entries_ = reinterpret_cast<const SnapshotEntry*>(base_ + sizeof(SnapshotHeader));
+        if (snapshot_checksum(header_, entries_) != header_.checksum) return fail("bad checksum");
+        return true;
+    }
+
+    void close() {
+        if (base_) munmap(const_cast<char*>(base_), size_);
+        base_ = nullptr;
+        entries_ = nullptr;
+        size_ = 0;
+    }
+
+    const SnapshotHeader& header() const { return header_; }
+    const SnapshotEntry* entries() const { return entries_; }
+    uint32_t entry_count() const { return entries_ ? header_.entry_count : 0; }
+    const char* error() const { return error_; }
+
+    static std::string entry_name(const SnapshotEntry& entry) {
+        return std::string(entry.name, strnlen(entry.name, sizeof(entry.name)));
+    }
+
+private:
+    bool fail(const char* why) {
+        close();
+        error_ = why;
+        return false;
+    }
+
+    const char* base_ = nullptr;
+    size_t size_ = 0;
+    SnapshotHeader header_{};
+    const SnapshotEntry* entries_ = nullptr;
+    const char* error_ = "";
+};
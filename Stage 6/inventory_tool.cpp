@@ -0,0 +1,112 @@
+// File: inventory_tool.cpp
+// Description: Converts between the text inventory file (NAME value per line, as written by
+//              drinks_bar -f) and the binary snapshot used by drinks_bar --snapshot, and
+//              verifies snapshots.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include "inventory_schema.hpp"
+#include "inventory_snapshot.hpp"
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage:\n";
+    std::cerr << "  " << prog << " export <snapshot> [text_file]          # snapshot -> text (stdout by default)\n";
+    std::cerr << "  " << prog << " import <text_file> <snapshot> [version] # text -> snapshot\n";
+    std::cerr << "  " << prog << " verify <snapshot>                       # check header and checksum\n";
+}
+
+int open_view(const char* path, SnapshotView& view) {
+    if (!view.open(path)) {
+        std::cerr << "Error: " << path << ": " << view.error() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int export_snapshot(const char* snapshot, const char* text_path) {
+    SnapshotView view;
+    if (open_view(snapshot, view)) return 1;
+    std::ofstream file;
+    if (text_path) {
+        file.open(text_path);
+        if (!file) {
+            perror("open (text file)");
+            return 1;
+        }
+    }
+    std::ostream& out = text_path ? file : std::cout;
+    for (uint32_t i = 0; i < view.entry_count(); ++i) {
+        out << SnapshotView::entry_name(view.entries()[i]) << " " << view.entries()[i].level << "\n";
+    }
+    return out ? 0 : 1;
+}
+
+// Lines are "NAME value"; names may contain spaces ("CARBON DIOXIDE 3"), so the value is the
+// last word. Names outside the schema are kept too and simply ignored by drinks_bar.
+int import_text(const char* text_path, const char* snapshot, uint64_t version) {
+    std::ifstream in(text_path);
+    if (!in) {
+        perror("open (text file)");
+        return 1;
+    }
+    std::vector<SnapshotEntry> entries;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        size_t end = line.find_last_not_of(" \t\r");
+        if (end == std::string::npos) continue;
+        size_t split = line.find_last_of(" \t", end);
+        size_t start = line.find_first_not_of(" \t");
+        char* num_end = nullptr;
+        long long level = split == std::string::npos ? 0 : std::strtoll(line.c_str() + split + 1, &num_end, 10);
+        std::string name = split == std::string::npos ? "" : line.substr(start, line.find_last_not_of(" \t", split) + 1 - start);
+        if (name.empty() || num_end != line.c_str() + end + 1 || name.size() >= sizeof(SnapshotEntry::name)) {
+            std::cerr << "Error: " << text_path << ":" << line_no << ": expected \"NAME value\"\n";
+            return 1;
+        }
+        if (stock_key_id(name.data(), name.size()) < 0) {
+            std::cerr << "Warning: " << text_path << ":" << line_no << ": unknown name " << name << "\n";
+        }
+        SnapshotEntry entry{};
+        std::memcpy(entry.name, name.data(), name.size());
+        entry.level = level;
+        entries.push_back(entry);
+    }
+
+    std::string tmp_path = std::string(snapshot) + ".tmp";
+    if (!write_snapshot(snapshot, tmp_path.c_str(), version, entries.data(), (uint32_t)entries.size())) {
+        perror("write snapshot");
+        return 1;
+    }
+    std::cout << "Wrote " << entries.size() << " entries to " << snapshot << " (version " << version << ")\n";
+    return 0;
+}
+
+int verify_snapshot(const char* snapshot) {
+    SnapshotView view;
+    if (open_view(snapshot, view)) return 1;
+    const SnapshotHeader& header = view.header();
+    std::cout << snapshot << ": format " << header.format << ", version " << header.inventory_version << ", "
+              << header.entry_count << " entries, checksum " << header.checksum << ", OK\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::string command = argv[1];
+    if (command == "export" && argc <= 4) return export_snapshot(argv[2], argc == 4 ? argv[3] : nullptr);
+    if (command == "import" && (argc == 4 || argc == 5)) {
+        return import_text(argv[2], argv[3], argc == 5 ? std::strtoull(argv[4], nullptr, 10) : 1);
+    }
+    if (command == "verify" && argc == 3) return verify_snapshot(argv[2]);
+    print_usage(argv[0]);
+    return 1;
+}
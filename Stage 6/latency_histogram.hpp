@@ -0,0 +1,82 @@
+// File: latency_histogram.hpp
+// Description: HDR-style log-linear latency histogram (nanosecond values, ~0.1% precision,
+//              fixed memory) with merge and percentile queries, used by the benchmark tools.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 11;                  // 2048 linear steps per power of two
+    static constexpr uint64_t HALF = 1ull << (SUB_BITS - 1);
+    static constexpr int MAX_SHIFT = 40 - SUB_BITS;      // values are clamped at ~2^40 ns (18 min)
+
+    LatencyHistogram() : counts_((MAX_SHIFT + 2) * HALF, 0) {}
+
+    void record(uint64_t ns) {
+        ++counts_[index_of(ns)];
+        ++total_;
+        sum_ += ns;
+        if (ns > max_) max_ = ns;
+        if (total_ == 1 || ns < min_) min_ = ns;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+        if (other.total_ && (!total_ || other.min_ < min_)) min_ = other.min_;
+        if (other.max_ > max_) max_ = other.max_;
+        total_ += other.total_;
+        sum_ += other.sum_;
+    }
+
+    // Smallest recorded value v such that at least p (0..1) of the samples are <= v.
+    uint64_t percentile(double p) const {
+        if (total_ == 0) return 0;
+        uint64_t rank = (uint64_t)(p * total_);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                uint64_t v = highest_equivalent(i);
+                return v > max_ ? max_ : v;
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    uint64_t min() const { return min_; }
+    double mean() const { return total_ ? (double)sum_ / total_ : 0.0; }
+
+    void print(FILE* out, const char* label) const {
+        fprintf(out, "%s latency (us): min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f  (n=%llu)\n",
+                label, min_ / 1e3, percentile(0.50) / 1e3, percentile(0.90) / 1e3, percentile(0.99) / 1e3,
+                percentile(0.999) / 1e3, max_ / 1e3, mean() / 1e3, (unsigned long long)total_);
+    }
+
+private:
+    static size_t index_of(uint64_t v) {
+        if (v < 2 * HALF) return (size_t)v;
+        int shift = 63 - __builtin_clzll(v) - (SUB_BITS - 1);
+        if (shift > MAX_SHIFT) return (MAX_SHIFT + 2) * HALF - 1;
+        return (size_t)((shift + 1) * HALF + ((v >> shift) - HALF));
+    }
+
+    static uint64_t highest_equivalent(size_t index) {
+        if (index < 2 * HALF) return index;
+        uint64_t shift = index / HALF - 1;
+        uint64_t mantissa = index % HALF + HALF;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+    uint64_t min_ = 0;
+};
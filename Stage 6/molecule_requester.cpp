@@ -1,4 +1,3 @@
-
 // File: molecule_requester.cpp
 // Description: Sends molecule requests via UDP or UDS-DGRAM to warehouse
 
@@ -6,100 +5,366 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+#include <poll.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/un.h>
+#include "latency_histogram.hpp"
+#include "shm_ring.hpp"
 
 constexpr int BUFFER_SIZE = 1024;
 
+using Clock = std::chrono::steady_clock;
+
 void print_usage(const char* prog) {
     std::cerr << "Usage:\n";
     std::cerr << "  " << prog << " <HOSTNAME> <PORT>       # UDP mode\n";
     std::cerr << "  " << prog << " -f <UDS_SOCKET_PATH>    # UDS datagram mode\n";
+    std::cerr << "  " << prog << " -q <SEQPACKET_PATH>     # UDS seqpacket mode (drinks_bar --seqpacket-path)\n";
+    std::cerr << "  " << prog << " -m <SHM_NAME> [--shm-busy-poll]    # shared-memory mode (drinks_bar -m)\n";
+    std::cerr << "  " << prog << " --replay <FILE> [--workers K] [--rate R] (<HOSTNAME> <PORT> | -f <UDS_SOCKET_PATH> |\n"
+              << "      -q <SEQPACKET_PATH> | -m <SHM_NAME>)\n";
+    std::cerr << "  --replay: send the file's DELIVER lines from K sockets at R orders/s in total\n";
+    std::cerr << "            (R = 0: as fast as replies allow) and report throughput and latency;\n";
+    std::cerr << "            over sockets each order goes out with \"TAG <seq>\" appended, which the bar\n";
+    std::cerr << "            (or bar_router) echoes, so parked and forwarded replies still match\n";
+    std::cerr << "  --shm-busy-poll: spin on the reply ring instead of sleeping on a futex\n";
+    std::cerr << "  (over shared memory WAIT orders are answered at once)\n";
 }
 
-int main(int argc, char* argv[]) {
-    int sockfd = -1;
-    sockaddr_storage server_addr{};
-    socklen_t server_addr_len = 0;
+struct ServerAddress {
+    sockaddr_storage addr{};
+    socklen_t len = 0;
     bool is_uds = false;
-    std::string server_ip = "";
-    int port = 0;
+};
 
-    if (argc == 3 && std::string(argv[1]) == "-f") {
-        // UDS-DGRAM mode
-        is_uds = true;
-        std::string uds_path = argv[2];
+bool resolve_server(const std::string& uds_path, const char* hostname, int port, ServerAddress& out) {
+    if (!uds_path.empty()) {
+        sockaddr_un* dest = (sockaddr_un*)&out.addr;
+        dest->sun_family = AF_UNIX;
+        std::strncpy(dest->sun_path, uds_path.c_str(), sizeof(dest->sun_path) - 1);
+        out.len = sizeof(sockaddr_un);
+        out.is_uds = true;
+        return true;
+    }
 
-        sockfd = socket(AF_UNIX, SOCK_DGRAM, 0);
-        if (sockfd < 0) {
-            perror("socket (UDS)");
-            return 1;
-        }
+    struct hostent* server = gethostbyname(hostname);
+    if (!server) {
+        std::cerr << "Error: No such host.\n";
+        return false;
+    }
+    sockaddr_in* udp_addr = (sockaddr_in*)&out.addr;
+    udp_addr->sin_family = AF_INET;
+    udp_addr->sin_port = htons(port);
+    std::memcpy(&udp_addr->sin_addr.s_addr, server->h_addr, server->h_length);
+    out.len = sizeof(sockaddr_in);
+    return true;
+}
 
-        // Bind to a unique path to receive replies
-        std::string client_path = "/tmp/molecule_client_" + std::to_string(getpid());
+// UDS datagram clients bind a unique path so the warehouse can reply.
+std::string client_path_for(int worker) {
+    std::string path = "/tmp/molecule_client_" + std::to_string(getpid());
+    if (worker >= 0) path += "_" + std::to_string(worker);
+    return path;
+}
+
+int open_socket(const ServerAddress& server, int worker) {
+    int sockfd = socket(server.is_uds ? AF_UNIX : AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror(server.is_uds ? "socket (UDS)" : "socket (UDP)");
+        return -1;
+    }
+    if (server.is_uds) {
+        std::string client_path = client_path_for(worker);
         sockaddr_un client_addr{};
         client_addr.sun_family = AF_UNIX;
         std::strncpy(client_addr.sun_path, client_path.c_str(), sizeof(client_addr.sun_path) - 1);
         unlink(client_path.c_str());
         if (bind(sockfd, (sockaddr*)&client_addr, sizeof(client_addr)) < 0) {
             perror("bind (UDS client)");
-            return 1;
+            close(sockfd);
+            return -1;
         }
+    }
+    return sockfd;
+}
 
-        // Destination
-        sockaddr_un* dest = (sockaddr_un*)&server_addr;
-        dest->sun_family = AF_UNIX;
-        std::strncpy(dest->sun_path, uds_path.c_str(), sizeof(dest->sun_path) - 1);
-        server_addr_len = sizeof(sockaddr_un);
+// Where a worker's orders go: the bar's datagram socket, a connected SEQPACKET socket
+// (server unset), or a shared-memory channel (-m).
+struct RequestLink {
+    int sockfd = -1;
+    const ServerAddress* server = nullptr;
+    ShmClient* shm = nullptr;
+    bool busy_poll = false;
 
-        std::cout << "Connected to warehouse via UDS-DGRAM: " << uds_path << std::endl;
+    bool send(const std::string& order) {
+        if (shm) return shm->send(order);
+        if (!server) return ::send(sockfd, order.data(), order.size(), MSG_NOSIGNAL) >= 0;
+        return sendto(sockfd, order.data(), order.size(), 0, (const sockaddr*)&server->addr, server->len) >= 0;
     }
 
-    else if (argc == 3) {
-        // UDP mode
-        const char* hostname = argv[1];
-        server_ip = hostname;
-        try {
-            port = std::stoi(argv[2]);
-        } catch (...) {
-            std::cerr << "Invalid port number.\n";
-            print_usage(argv[0]);
-            return 1;
+    // A shared-memory channel takes only SHM_RING_SLOTS orders ahead of their replies.
+    bool full() const { return shm && shm->outstanding() == SHM_RING_SLOTS; }
+
+    // Waits up to timeout_ms (-1: forever) for one reply; returns its length, or -1.
+    ssize_t receive(char* buffer, size_t size, int timeout_ms) {
+        if (shm) {
+            std::string reply;
+            if (!shm->receive(reply, busy_poll, timeout_ms)) return -1;
+            size_t len = std::min(reply.size(), size);
+            std::memcpy(buffer, reply.data(), len);
+            return len;
         }
+        pollfd pfd{sockfd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+        return recv(sockfd, buffer, size, 0);
+    }
+};
 
-        struct hostent* server = gethostbyname(hostname);
-        if (!server) {
-            std::cerr << "Error: No such host.\n";
-            return 1;
+// A connected SEQPACKET socket: replies arrive on it in order and no client path is bound.
+int connect_seqpacket(const std::string& path) {
+    int sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("socket (UDS seqpacket)");
+        return -1;
+    }
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(sockfd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect (UDS seqpacket)");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// === Replay mode ===
+
+struct ReplayStats {
+    uint64_t sent = 0;
+    uint64_t ok = 0;
+    uint64_t failed = 0;
+    uint64_t timed_out = 0;
+    LatencyHistogram latency;
+};
+
+// Open-loop sender: order i of the file is due at start + i / rate no matter how slowly
+// earlier replies come back, and latency is measured from that due time, so a stalled bar
+// shows up in the histogram instead of silently lowering the offered load. Over a socket a
+// datagram can be lost (and a parked order answered late), so orders carry "TAG <seq>" and
+// replies are matched by the tag the bar echoes; a lost reply only counts as timed out.
+// Shared-memory replies come back in request order and are matched FIFO.
+void replay_worker(RequestLink& link, const std::vector<std::string>& orders, int worker, int workers, double rate,
+                   Clock::time_point start, ReplayStats& stats) {
+    constexpr size_t CLOSED_LOOP_WINDOW = 64;
+    bool tagged = !link.shm;
+    std::map<uint64_t, Clock::time_point> inflight;  // due time by request seq
+    uint64_t next_seq = 1;
+    char buffer[BUFFER_SIZE];
+
+    auto take_reply = [&](int timeout_ms) {
+        ssize_t len = link.receive(buffer, sizeof(buffer) - 1, timeout_ms);
+        if (len <= 0) return false;
+        buffer[len] = '\0';
+        auto it = inflight.begin();
+        if (tagged) {
+            const char* tag = std::strstr(buffer, " TAG ");
+            it = tag ? inflight.find(std::strtoull(tag + 5, nullptr, 10)) : inflight.end();
         }
+        if (it == inflight.end()) return true;  // nothing of ours, or already given up on
+        auto now = Clock::now();
+        stats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - it->second).count());
+        inflight.erase(it);
+        if (std::strncmp(buffer, "OK", 2) == 0) ++stats.ok;
+        else ++stats.failed;
+        return true;
+    };
 
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd < 0) {
-            perror("socket (UDP)");
-            return 1;
+    for (size_t i = worker; i < orders.size(); i += workers) {
+        Clock::time_point due = Clock::now();
+        if (rate > 0) {
+            due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(i / rate));
+            while (true) {
+                auto now = Clock::now();
+                if (now >= due) break;
+                int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count();
+                if (!take_reply(wait_ms) && wait_ms == 0) std::this_thread::yield();
+            }
+        } else {
+            while (inflight.size() >= CLOSED_LOOP_WINDOW && take_reply(1000)) {}
+        }
+        while (link.full() && take_reply(1000)) {}
+
+        uint64_t seq = next_seq++;
+        if (!link.send(tagged ? orders[i] + " TAG " + std::to_string(seq) : orders[i])) {
+            perror("send");
+            ++stats.failed;
+            continue;
+        }
+        ++stats.sent;
+        inflight.emplace(seq, due);
+        while (take_reply(0)) {}
+    }
+
+    while (!inflight.empty() && take_reply(2000)) {}
+    stats.timed_out = inflight.size();
+}
+
+int run_replay(const std::string& path, int workers, double rate, const ServerAddress& server,
+               const std::string& seqpacket_path, const std::string& shm_name, bool busy_poll) {
+    std::ifstream in(path);
+    if (!in) {
+        perror("open (replay file)");
+        return 1;
+    }
+    std::vector<std::string> orders;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") != std::string::npos) orders.push_back(line);
+    }
+
+    std::vector<RequestLink> links(workers);
+    std::vector<ShmClient> channels(shm_name.empty() ? 0 : workers);
+    for (int w = 0; w < workers; ++w) {
+        RequestLink& link = links[w];
+        link.busy_poll = busy_poll;
+        if (!shm_name.empty()) {
+            if (!channels[w].attach(shm_name)) return 1;
+            link.shm = &channels[w];
+            continue;
         }
+        if (!seqpacket_path.empty()) {
+            link.sockfd = connect_seqpacket(seqpacket_path);
+        } else {
+            link.sockfd = open_socket(server, w);
+            link.server = &server;
+        }
+        if (link.sockfd < 0) return 1;
+    }
+
+    std::cout << "Replaying " << orders.size() << " orders from " << path << " with " << workers
+              << " worker(s) at " << (rate > 0 ? std::to_string((long long)rate) + " orders/s" : "max rate") << std::endl;
+
+    std::vector<ReplayStats> stats(workers);
+    std::vector<std::thread> threads;
+    auto start = Clock::now() + std::chrono::milliseconds(10);
+    for (int w = 0; w < workers; ++w) {
+        threads.emplace_back(replay_worker, std::ref(links[w]), std::cref(orders), w, workers, rate, start,
+                             std::ref(stats[w]));
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    ReplayStats total;
+    for (const ReplayStats& s : stats) {
+        total.sent += s.sent;
+        total.ok += s.ok;
+        total.failed += s.failed;
+        total.timed_out += s.timed_out;
+        total.latency.merge(s.latency);
+    }
+    for (int w = 0; w < workers; ++w) {
+        if (links[w].sockfd < 0) continue;
+        close(links[w].sockfd);
+        if (links[w].server && server.is_uds) unlink(client_path_for(w).c_str());
+    }
 
-        sockaddr_in* udp_addr = (sockaddr_in*)&server_addr;
-        udp_addr->sin_family = AF_INET;
-        udp_addr->sin_port = htons(port);
-        std::memcpy(&udp_addr->sin_addr.s_addr, server->h_addr, server->h_length);
-        server_addr_len = sizeof(sockaddr_in);
+    printf("Sent %llu orders in %.3f s (%.0f orders/s): %llu OK, %llu FAILED, %llu timed out\n",
+           (unsigned long long)total.sent, seconds, seconds > 0 ? total.sent / seconds : 0.0,
+           (unsigned long long)total.ok, (unsigned long long)total.failed, (unsigned long long)total.timed_out);
+    total.latency.print(stdout, "Order");
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string uds_path, replay_path, shm_name, seqpacket_path;
+    int workers = 1;
+    double rate = 0;
+    bool busy_poll = false;
 
-        std::cout << "Connected to warehouse via UDP: " << server_ip << ":" << port << std::endl;
+    static struct option long_options[] = {
+        {"replay", required_argument, nullptr, 'r'},
+        {"workers", required_argument, nullptr, 'k'},
+        {"rate", required_argument, nullptr, 'R'},
+        {"shm-busy-poll", no_argument, nullptr, 'B'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:m:q:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'f': uds_path = optarg; break;
+            case 'q': seqpacket_path = optarg; break;
+            case 'm': shm_name = optarg; break;
+            case 'B': busy_poll = true; break;
+            case 'r': replay_path = optarg; break;
+            case 'k': workers = std::max(1, std::atoi(optarg)); break;
+            case 'R': rate = std::atof(optarg); break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
     }
 
-    else {
+    const char* hostname = nullptr;
+    int port = 0;
+    bool local = !uds_path.empty() || !shm_name.empty() || !seqpacket_path.empty();
+    if (!local) {
+        if (argc - optind != 2) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        hostname = argv[optind];
+        try {
+            port = std::stoi(argv[optind + 1]);
+        } catch (...) {
+            std::cerr << "Invalid port number.\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    } else if (argc != optind) {
         print_usage(argv[0]);
         return 1;
     }
 
+    ServerAddress server;
+    if (shm_name.empty() && seqpacket_path.empty() && !resolve_server(uds_path, hostname, port, server)) return 1;
+    if (!replay_path.empty()) return run_replay(replay_path, workers, rate, server, seqpacket_path, shm_name, busy_poll);
+
+    RequestLink link;
+    ShmClient channel;
+    link.busy_poll = busy_poll;
+    if (!shm_name.empty()) {
+        if (!channel.attach(shm_name)) return 1;
+        link.shm = &channel;
+        std::cout << "Connected to warehouse via shared memory: " << shm_name << " (channel "
+                  << channel.channel_index() << ")" << std::endl;
+    } else if (!seqpacket_path.empty()) {
+        link.sockfd = connect_seqpacket(seqpacket_path);
+        if (link.sockfd < 0) return 1;
+        std::cout << "Connected to warehouse via UDS-SEQPACKET: " << seqpacket_path << std::endl;
+    } else {
+        link.sockfd = open_socket(server, -1);
+        link.server = &server;
+        if (link.sockfd < 0) return 1;
+        if (server.is_uds) std::cout << "Connected to warehouse via UDS-DGRAM: " << uds_path << std::endl;
+        else std::cout << "Connected to warehouse via UDP: " << hostname << ":" << port << std::endl;
+    }
+
     // Interaction
-    std::cout << "Enter molecule requests (e.g., DELIVER WATER 2). Ctrl+D to quit.\n";
+    std::cout << "Enter molecule requests (e.g., DELIVER WATER 2, or DELIVER WATER 2 WAIT 5000 to wait for stock). Ctrl+D to quit.\n";
     std::string line;
     char buffer[BUFFER_SIZE];
 
@@ -107,17 +372,15 @@ int main(int argc, char* argv[]) {
         if (line.empty()) continue;
 
         // Send
-        ssize_t sent = sendto(sockfd, line.c_str(), line.length(), 0,
-                              (sockaddr*)&server_addr, server_addr_len);
-        if (sent < 0) {
-            perror("sendto");
+        if (!link.send(line)) {
+            perror("send");
             continue;
         }
 
         // Receive
-        ssize_t len = recvfrom(sockfd, buffer, BUFFER_SIZE - 1, 0, nullptr, nullptr);
+        ssize_t len = link.receive(buffer, BUFFER_SIZE - 1, -1);
         if (len < 0) {
-            perror("recvfrom");
+            perror("recv");
             continue;
         }
 
@@ -125,10 +388,9 @@ int main(int argc, char* argv[]) {
         std::cout << "Server response: " << buffer << std::endl;
     }
 
-    close(sockfd);
-    if (is_uds) {
-        std::string client_path = "/tmp/molecule_client_" + std::to_string(getpid());
-        unlink(client_path.c_str());
+    if (link.sockfd >= 0) close(link.sockfd);
+    if (link.server && server.is_uds) {
+        unlink(client_path_for(-1).c_str());
     }
 
     return 0;
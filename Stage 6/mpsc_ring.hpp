@@ -0,0 +1,65 @@
+// File: mpsc_ring.hpp
+// Description: Bounded lock-free multi-producer / single-consumer ring. Every slot carries a
+//              sequence number: producers claim a position with one CAS and publish the slot
+//              by bumping its sequence, and the consumer takes slots strictly in claim order.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+template <typename T>
+class MpscRing {
+public:
+    explicit MpscRing(size_t capacity = 1 << 16) {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        slots_.reset(new Slot[cap]);
+        mask_ = cap - 1;
+        for (size_t i = 0; i < cap; ++i) slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // Any thread. Returns false when the ring is full.
+    bool push(const T& value) {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[pos & mask_];
+            int64_t lag = (int64_t)(slot.seq.load(std::memory_order_acquire) - pos);
+            if (lag == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;  // the consumer has not freed this slot yet
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only. Returns false when the next slot is not published yet.
+    bool pop(T& out) {
+        Slot& slot = slots_[tail_ & mask_];
+        if (slot.seq.load(std::memory_order_acquire) != tail_ + 1) return false;
+        out = slot.value;
+        slot.seq.store(tail_ + mask_ + 1, std::memory_order_release);
+        ++tail_;
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) uint64_t tail_ = 0;
+};
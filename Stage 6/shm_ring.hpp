@@ -0,0 +1,471 @@
+// File: shm_ring.hpp
+// Description: Shared-memory transport for clients on the bar's host (drinks_bar -m NAME,
+//              atom_supplier -m NAME, molecule_requester -m NAME). The bar creates
+//              /dev/shm/NAME holding SHM_CHANNELS channels; a client claims one and then
+//              talks to the bar through two SPSC rings of fixed 256-byte lines, one for
+//              requests and one for replies. Every request gets exactly one reply, and a
+//              client keeps at most SHM_RING_SLOTS requests outstanding, so the bar never
+//              finds a reply ring full.
+//
+//   Wakeups cost a syscall only when the other side sleeps: a consumer that runs out of
+//   spin announces itself in a *_sleeping word and futex-waits on a signal word, and a
+//   producer bumps the signal and FUTEX_WAKEs only if that flag is set. Clients ring one
+//   doorbell for the whole segment; the bar turns it into an eventfd for its epoll loop.
+//   A busy-polling bar stays awake while it spins, so clients do not ring then.
+//
+//   Channel states: FREE -> CLAIMED (client records its pid, resets the rings) -> ACTIVE ->
+//   CLOSING (client leaves, or a client finds the owner pid dead, also while CLAIMED) ->
+//   FREE (only the bar frees, clearing the owner first, so it is never in the middle of a
+//   channel that gets reset). Lines never exceed SHM_LINE_BYTES; longer ones are refused.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr uint32_t SHM_MAGIC = 0x52414244;  // "DBAR"
+constexpr size_t SHM_CHANNELS = 32;
+constexpr size_t SHM_RING_SLOTS = 256;
+constexpr size_t SHM_LINE_BYTES = 254;   // fits a full INVENTORY reply
+constexpr unsigned SHM_PAUSE_POLLS = 64;   // pure spinning, then polls yield the CPU
+constexpr unsigned SHM_SPIN_POLLS = 2000;  // polls before a waiting side goes to sleep
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "futex words must be plain 32-bit memory");
+
+inline void shm_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+inline void shm_futex_wait(std::atomic<uint32_t>& word, uint32_t expected, int timeout_ms) {
+    timespec ts{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeout_ms >= 0 ? &ts : nullptr,
+            nullptr, 0);
+}
+
+inline void shm_futex_wake(std::atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+// Producer side, after publishing: wakes the consumer only if it said it is going to sleep.
+inline void shm_notify(std::atomic<uint32_t>& sleeping, std::atomic<uint32_t>& signal) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+        signal.fetch_add(1, std::memory_order_release);
+        shm_futex_wake(signal);
+    }
+}
+
+struct ShmLine {
+    uint16_t len;
+    char text[SHM_LINE_BYTES];
+};
+static_assert(sizeof(ShmLine) == 256, "lines are whole cache lines");
+
+// SpscQueue with both indices in the shared segment; each side's cached copy of the other
+// index sits on its own cache line.
+struct ShmRing {
+    alignas(64) std::atomic<uint32_t> head;  // producer
+    uint32_t cached_tail;
+    alignas(64) std::atomic<uint32_t> tail;  // consumer
+    uint32_t cached_head;
+    ShmLine lines[SHM_RING_SLOTS];
+
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        cached_tail = 0;
+        cached_head = 0;
+    }
+
+    // False when the ring is full or text does not fit in one line.
+    bool push(std::string_view text) {
+        if (text.size() > SHM_LINE_BYTES) return false;
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - cached_tail == SHM_RING_SLOTS) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h - cached_tail == SHM_RING_SLOTS) return false;
+        }
+        ShmLine& line = lines[h % SHM_RING_SLOTS];
+        line.len = (uint16_t)text.size();
+        std::memcpy(line.text, text.data(), line.len);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(ShmLine& out) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == cached_head) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t == cached_head) return false;
+        }
+        out = lines[t % SHM_RING_SLOTS];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+};
+
+enum ShmChannelState : uint32_t { SHM_FREE, SHM_CLAIMED, SHM_ACTIVE, SHM_CLOSING };
+
+struct ShmChannel {
+    alignas(64) std::atomic<uint32_t> state;
+    std::atomic<int32_t> owner;           // client pid, 0 while FREE
+    std::atomic<uint32_t> generation;     // bumped on every claim
+    alignas(64) std::atomic<uint32_t> client_sleeping;
+    std::atomic<uint32_t> reply_signal;   // client's futex word
+    ShmRing requests;
+    ShmRing replies;
+};
+
+struct ShmSegment {
+    uint32_t magic;
+    uint32_t channels;
+    alignas(64) std::atomic<uint32_t> server_sleeping;
+    std::atomic<uint32_t> doorbell;       // bar's futex word
+    std::atomic<uint32_t> server_pid;
+    ShmChannel channel[SHM_CHANNELS];
+};
+
+inline std::string shm_object_name(const std::string& name) { return name[0] == '/' ? name : "/" + name; }
+
+// Client end: one claimed channel, used by one thread.
+class ShmClient {
+public:
+    ShmClient() = default;
+    ShmClient(const ShmClient&) = delete;
+    ShmClient& operator=(const ShmClient&) = delete;
+    ~ShmClient() { detach(); }
+
+    bool attach(const std::string& name) {
+        int fd = shm_open(shm_object_name(name).c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            perror("shm_open");
+            return false;
+        }
+        void* mem = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) {
+            perror("mmap (shm)");
+            return false;
+        }
+        seg_ = static_cast<ShmSegment*>(mem);
+        if (seg_->magic != SHM_MAGIC) {
+            fprintf(stderr, "shm: %s is not a drinks_bar segment\n", name.c_str());
+            detach();
+            return false;
+        }
+        for (int attempt = 0; attempt < 100; ++attempt) {
+            if (claim()) return true;
+            reap_dead_owners();
+            timespec nap{0, 1000000};
+            nanosleep(&nap, nullptr);
+        }
+        fprintf(stderr, "shm: all %zu channels of %s are in use\n", SHM_CHANNELS, name.c_str());
+        detach();
+        return false;
+    }
+
+    void detach() {
+        if (!seg_) return;
+        if (chan_) {
+            chan_->state.store(SHM_CLOSING, std::memory_order_release);
+            ring_doorbell();
+            chan_ = nullptr;
+        }
+        munmap(seg_, sizeof(ShmSegment));
+        seg_ = nullptr;
+    }
+
+    size_t channel_index() const { return chan_ - seg_->channel; }
+    size_t outstanding() const { return outstanding_; }
+
+    // Queues one request line; false (errno EAGAIN) once SHM_RING_SLOTS requests are waiting
+    // for replies, or (EMSGSIZE) for a line longer than SHM_LINE_BYTES.
+    bool send(std::string_view line) {
+        if (line.size() > SHM_LINE_BYTES) {
+            errno = EMSGSIZE;
+            return false;
+        }
+        if (outstanding_ == SHM_RING_SLOTS || !chan_->requests.push(line)) {
+            errno = EAGAIN;
+            return false;
+        }
+        ++outstanding_;
+        ring_doorbell();
+        return true;
+    }
+
+    // Takes the next reply, spinning first and then sleeping on the futex (busy_poll: spin
+    // only). timeout_ms < 0 waits forever; false on timeout.
+    bool receive(std::string& reply, bool busy_poll, int timeout_ms) {
+        ShmLine line;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unsigned polls = 0;
+        while (!chan_->replies.pop(line)) {
+            if (timeout_ms >= 0 && elapsed_ms(start) >= timeout_ms) return false;
+            ++polls;
+            if (busy_poll || polls < SHM_SPIN_POLLS) {
+                if (polls < SHM_PAUSE_POLLS) shm_cpu_relax();
+                else std::this_thread::yield();  // lets the bar run when it shares our core
+                continue;
+            }
+            uint32_t signal = chan_->reply_signal.load(std::memory_order_acquire);
+            chan_->client_sleeping.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (chan_->replies.empty()) {
+                int nap_ms = timeout_ms < 0 ? 100 : (int)std::max<int64_t>(1, timeout_ms - elapsed_ms(start));
+                shm_futex_wait(chan_->reply_signal, signal, std::min(nap_ms, 100));
+            }
+            chan_->client_sleeping.store(0, std::memory_order_relaxed);
+        }
+        --outstanding_;
+        reply.assign(line.text, line.len);
+        return true;
+    }
+
+private:
+    static int64_t elapsed_ms(const timespec& start) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+    }
+
+    bool claim() {
+        for (ShmChannel& chan : seg_->channel) {
+            uint32_t expected = SHM_FREE;
+            if (!chan.state.compare_exchange_strong(expected, SHM_CLAIMED, std::memory_order_acquire)) continue;
+            chan.owner.store(getpid(), std::memory_order_release);  // so a claim we die in is reaped
+            chan.requests.reset();
+            chan.replies.reset();
+            chan.client_sleeping.store(0, std::memory_order_relaxed);
+            chan.generation.fetch_add(1, std::memory_order_relaxed);
+            chan.state.store(SHM_ACTIVE, std::memory_order_release);
+            chan_ = &chan;
+            return true;
+        }
+        return false;
+    }
+
+    // Channels of clients that died without detaching, or while claiming, go back to the bar
+    // to be freed. An owner of 0 is a claim whose pid is not stored yet.
+    void reap_dead_owners() {
+        for (ShmChannel& chan : seg_->channel) {
+            uint32_t state = chan.state.load(std::memory_order_acquire);
+            if (state != SHM_ACTIVE && state != SHM_CLAIMED) continue;
+            int32_t owner = chan.owner.load(std::memory_order_acquire);
+            if (owner > 0 && kill(owner, 0) < 0 && errno == ESRCH) {
+                chan.state.compare_exchange_strong(state, SHM_CLOSING, std::memory_order_acq_rel);
+            }
+        }
+        ring_doorbell();
+    }
+
+    void ring_doorbell() { shm_notify(seg_->server_sleeping, seg_->doorbell); }
+
+    ShmSegment* seg_ = nullptr;
+    ShmChannel* chan_ = nullptr;
+    size_t outstanding_ = 0;
+};
+
+// Bar end. Everything but the doorbell thread runs on the event loop; that thread only
+// forwards futex wakeups to wake_fd().
+class ShmServer {
+public:
+    ShmServer() = default;
+    ShmServer(const ShmServer&) = delete;
+    ShmServer& operator=(const ShmServer&) = delete;
+    ~ShmServer() { destroy(); }
+
+    // Fails if NAME exists, unless it is a segment left behind by a bar that is gone.
+    bool create(const std::string& name) {
+        name_ = shm_object_name(name);
+        int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST && left_by_dead_bar()) {
+            shm_unlink(name_.c_str());
+            fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        }
+        if (fd < 0) {
+            if (errno == EEXIST) fprintf(stderr, "shm: %s already exists\n", name_.c_str());
+            else perror("shm_open");
+            return false;
+        }
+        if (ftruncate(fd, sizeof(ShmSegment)) < 0) {
+            perror("ftruncate (shm)");
+            close(fd);
+            return false;
+        }
+        void* mem = mmap(nullptr, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) {
+            perror("mmap (shm)");
+            return false;
+        }
+        seg_ = new (mem) ShmSegment();  // ftruncate zero-filled it: every channel is FREE
+        seg_->channels = SHM_CHANNELS;
+        seg_->server_pid.store(getpid(), std::memory_order_relaxed);
+        seg_->server_sleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        seg_->magic = SHM_MAGIC;
+
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd_ < 0) return false;
+        stop_.store(false, std::memory_order_relaxed);  // a failed takeover may have destroyed it
+        doorbell_thread_ = std::thread(&ShmServer::forward_doorbell, this);
+        return true;
+    }
+
+    bool enabled() const { return seg_ != nullptr; }
+
+    // Readable after a client rang the doorbell, which clients only do while the bar sleeps.
+    int wake_fd() const { return wake_fd_; }
+
+    void clear_wake() {
+        uint64_t value;
+        while (read(wake_fd_, &value, sizeof(value)) > 0) {}
+    }
+
+    // One pass over the channels, no syscalls: calls handle(channel, generation, line) for
+    // each waiting request and frees closed channels. A bar that polls every loop pass
+    // (busy-poll) uses this between wake() and sleep().
+    template <typename Handler>
+    size_t poll(Handler&& handle) {
+        size_t handled = 0;
+        for (size_t c = 0; c < SHM_CHANNELS; ++c) {
+            ShmChannel& chan = seg_->channel[c];
+            uint32_t state = chan.state.load(std::memory_order_acquire);
+            if (state == SHM_CLOSING) {
+                chan.owner.store(0, std::memory_order_relaxed);
+                chan.state.store(SHM_FREE, std::memory_order_release);
+                continue;
+            }
+            if (state != SHM_ACTIVE) continue;
+            uint32_t generation = chan.generation.load(std::memory_order_relaxed);
+            ShmLine line;
+            while (chan.requests.pop(line)) {
+                handle(c, generation, std::string_view(line.text, line.len));
+                ++handled;
+            }
+        }
+        return handled;
+    }
+
+    // Clients stop ringing until the next sleep().
+    void wake() { seg_->server_sleeping.store(0, std::memory_order_relaxed); }
+
+    // Announces that the bar is about to block; false (still awake) if a request or a
+    // close slipped in first, so nothing waits for a doorbell that was never rung.
+    bool sleep() {
+        seg_->server_sleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!work_waiting()) return true;
+        wake();
+        return false;
+    }
+
+    // Event-driven use: after the doorbell, handle everything and go back to sleep.
+    template <typename Handler>
+    size_t drain(Handler&& handle) {
+        clear_wake();
+        size_t handled = 0;
+        do {
+            wake();
+            handled += poll(handle);
+        } while (!sleep());
+        return handled;
+    }
+
+    // Pushes a reply unless the channel changed hands since the request was taken. One that
+    // does not fit in a line is answered FAILED, so the client still gets exactly one reply.
+    void reply(size_t c, uint32_t generation, std::string_view text) {
+        ShmChannel& chan = seg_->channel[c];
+        if (chan.state.load(std::memory_order_acquire) != SHM_ACTIVE ||
+            chan.generation.load(std::memory_order_relaxed) != generation) {
+            return;
+        }
+        if (text.size() > SHM_LINE_BYTES) text = "FAILED";
+        if (chan.replies.push(text)) shm_notify(chan.client_sleeping, chan.reply_signal);
+    }
+
+    void destroy() {
+        if (!seg_) return;
+        if (doorbell_thread_.joinable()) {
+            stop_.store(true, std::memory_order_release);
+            seg_->doorbell.fetch_add(1, std::memory_order_release);
+            shm_futex_wake(seg_->doorbell);
+            doorbell_thread_.join();
+        }
+        if (wake_fd_ >= 0) close(wake_fd_);
+        wake_fd_ = -1;
+        munmap(seg_, sizeof(ShmSegment));
+        seg_ = nullptr;
+        shm_unlink(name_.c_str());
+    }
+
+private:
+    // NAME holds a drinks_bar segment whose bar no longer runs (it crashed before unlinking).
+    bool left_by_dead_bar() const {
+        int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        void* mem = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmSegment)
+                        ? mmap(nullptr, sizeof(ShmSegment), PROT_READ, MAP_SHARED, fd, 0)
+                        : MAP_FAILED;
+        close(fd);
+        if (mem == MAP_FAILED) return false;
+        const ShmSegment* seg = static_cast<const ShmSegment*>(mem);
+        pid_t pid = (pid_t)seg->server_pid.load(std::memory_order_relaxed);
+        bool ours = seg->magic == SHM_MAGIC;
+        bool stale = ours && pid > 0 && kill(pid, 0) < 0 && errno == ESRCH;
+        munmap(mem, sizeof(ShmSegment));
+        if (ours && !stale) fprintf(stderr, "shm: bar pid %d still serves %s\n", (int)pid, name_.c_str());
+        errno = EEXIST;
+        return stale;
+    }
+
+    bool work_waiting() const {
+        for (const ShmChannel& chan : seg_->channel) {
+            uint32_t state = chan.state.load(std::memory_order_acquire);
+            if (state == SHM_CLOSING || (state == SHM_ACTIVE && !chan.requests.empty())) return true;
+        }
+        return false;
+    }
+
+    void forward_doorbell() {
+        uint32_t seen = seg_->doorbell.load(std::memory_order_acquire);
+        while (!stop_.load(std::memory_order_acquire)) {
+            shm_futex_wait(seg_->doorbell, seen, -1);
+            uint32_t now = seg_->doorbell.load(std::memory_order_acquire);
+            if (now == seen) continue;
+            seen = now;
+            uint64_t one = 1;
+            if (write(wake_fd_, &one, sizeof(one)) < 0) {}
+        }
+    }
+
+    std::string name_;
+    ShmSegment* seg_ = nullptr;
+    int wake_fd_ = -1;
+    std::thread doorbell_thread_;
+    std::atomic<bool> stop_{false};
+};
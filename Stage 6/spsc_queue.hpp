@@ -0,0 +1,61 @@
+// File: spsc_queue.hpp
+// Description: Bounded single-producer / single-consumer ring of trivially copyable values.
+//              Each side caches the other side's index and only reloads it when the ring
+//              looks full (producer) or empty (consumer), so the common case touches no
+//              shared cache line but its own.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity = 1024) {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        slots_.resize(cap);
+        mask_ = cap - 1;
+    }
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer only. Returns false when the ring is full.
+    bool push(const T& value) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ == slots_.size()) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ == slots_.size()) return false;
+        }
+        slots_[head & mask_] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false when the ring is empty.
+    bool pop(T& out) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == cached_head_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail == cached_head_) return false;
+        }
+        out = slots_[tail & mask_];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<uint64_t> head_{0};
+    uint64_t cached_tail_ = 0;  // producer's view of tail_
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    uint64_t cached_head_ = 0;  // consumer's view of head_
+};
@@ -0,0 +1,318 @@
+// File: stream_pipeline.hpp
+// Description: Parallel front half of drinks_bar --pipeline. I/O threads own the reading side
+//              of stream connections: they recv, parse with the batch parser and publish one
+//              PipelineItem per line into an MPSC ring that the single apply thread (the event
+//              loop) drains in order. Each connection stays on one I/O thread, so its lines
+//              keep their order. Acks and reply lines travel back through the owning
+//              thread's SPSC inbox, so only that thread ever writes to the socket.
+//
+//   I/O thread never blocks on the ring: when it is full, parsed items wait in a local
+//   backlog and no more sockets are read until the apply thread catches up.
+//   A connection that hits EOF is dropped from the thread's epoll and reported with a
+//   PIPE_CLOSED item; the apply thread does the close, so an fd is never reused while an
+//   I/O thread still watches it. So does a connection whose unfinished line passes
+//   PIPE_PENDING_LIMIT, or whose unsent replies pass PIPE_OUTBUF_LIMIT.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "command_parser.hpp"
+#include "mpsc_ring.hpp"
+#include "spsc_queue.hpp"
+
+enum PipeItemKind : uint8_t { PIPE_ADD, PIPE_TEXT, PIPE_CLOSED };
+
+constexpr size_t PIPE_TEXT_BYTES = 52;
+constexpr size_t PIPE_PENDING_LIMIT = 16384;     // same as the event loop's connection buffer
+constexpr size_t PIPE_OUTBUF_LIMIT = 1 << 20;
+
+struct PipelineItem {
+    int32_t fd;
+    int32_t count;
+    uint8_t kind;  // PipeItemKind
+    int8_t id;     // atom id for PIPE_ADD
+    uint16_t text_len;
+    char text[PIPE_TEXT_BYTES];  // PIPE_TEXT: the line, or a pointer to a heap copy of a longer one
+};
+static_assert(sizeof(PipelineItem) == 64, "one item per cache line");
+
+// The heap copy behind a PIPE_TEXT line longer than PIPE_TEXT_BYTES, or nullptr. The apply
+// thread owns it once the item is popped.
+inline char* pipe_long_text(const PipelineItem& item) {
+    if (item.kind != PIPE_TEXT || item.text_len <= PIPE_TEXT_BYTES) return nullptr;
+    char* text;
+    std::memcpy(&text, item.text, sizeof(text));
+    return text;
+}
+
+inline std::string_view pipe_text(const PipelineItem& item) {
+    char* long_text = pipe_long_text(item);
+    return std::string_view(long_text ? long_text : item.text, item.text_len);
+}
+
+class StreamPipeline {
+public:
+    ~StreamPipeline() { stop(); }
+
+    bool start(size_t threads, size_t ring_capacity = 1 << 16) {
+        ring_.reset(new MpscRing<PipelineItem>(ring_capacity));
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd_ < 0) return false;
+        for (size_t i = 0; i < threads; ++i) {
+            std::unique_ptr<IoThread> io(new IoThread);
+            io->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            io->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (io->epoll_fd < 0 || io->event_fd < 0 || !watch(io->epoll_fd, io->event_fd)) return false;
+            io_.push_back(std::move(io));
+        }
+        for (auto& io : io_) io->thread = std::thread(&StreamPipeline::run, this, io.get());
+        return true;
+    }
+
+    bool enabled() const { return !io_.empty(); }
+
+    size_t io_threads() const { return io_.size(); }
+    std::thread::native_handle_type io_handle(size_t thread) { return io_[thread]->thread.native_handle(); }
+
+    // Readable whenever items were published since the last clear_wake().
+    int wake_fd() const { return wake_fd_; }
+
+    void clear_wake() {
+        uint64_t value;
+        while (read(wake_fd_, &value, sizeof(value)) > 0) {}
+    }
+
+    bool pop(PipelineItem& item) { return ring_->pop(item); }
+
+    // Apply thread: hands a connected, non-blocking fd to the next I/O thread.
+    size_t adopt(int fd) {
+        size_t thread = next_thread_++ % io_.size();
+        post(thread, IoMessage{fd, 0, IO_ADOPT, nullptr});
+        flush_posts();
+        return thread;
+    }
+
+    // Apply thread: queues "ACK <seq>" for the I/O thread that owns fd; flush_posts() wakes it.
+    void post_ack(size_t thread, int fd, uint32_t seq) { post(thread, IoMessage{fd, seq, IO_ACK, nullptr}); }
+
+    // Apply thread: queues a reply line for fd behind its earlier acks and replies.
+    void post_text(size_t thread, int fd, std::string_view text) {
+        char* copy = new char[text.size()];
+        std::memcpy(copy, text.data(), text.size());
+        post(thread, IoMessage{fd, (uint32_t)text.size(), IO_TEXT, copy});
+    }
+
+    void flush_posts() {
+        for (auto& io : io_) {
+            if (!io->posted) continue;
+            io->posted = false;
+            uint64_t one = 1;
+            if (write(io->event_fd, &one, sizeof(one)) < 0) {}
+        }
+    }
+
+    void stop() {
+        if (io_.empty()) return;
+        stop_.store(true, std::memory_order_release);
+        for (auto& io : io_) {
+            uint64_t one = 1;
+            if (write(io->event_fd, &one, sizeof(one)) < 0) {}
+            if (io->thread.joinable()) io->thread.join();
+            close(io->epoll_fd);
+            close(io->event_fd);
+        }
+        io_.clear();
+        close(wake_fd_);
+    }
+
+private:
+    enum IoMessageKind : uint8_t { IO_ADOPT, IO_ACK, IO_TEXT };
+
+    struct IoMessage {
+        int fd;
+        uint32_t seq;  // IO_ACK: the ack; IO_TEXT: length of text
+        uint8_t kind;  // IoMessageKind
+        char* text;    // IO_TEXT: heap copy, freed by the I/O thread
+    };
+
+    struct Owned {
+        std::string in;   // unparsed tail
+        std::string out;  // acks and replies the socket has not taken yet
+        bool want_write = false;
+    };
+
+    struct IoThread {
+        int epoll_fd = -1;
+        int event_fd = -1;
+        SpscQueue<IoMessage> inbox{4096};
+        bool posted = false;  // apply-thread side: inbox has entries the thread was not woken for
+        std::thread thread;
+    };
+
+    // Sends what the socket takes and waits for EPOLLOUT for the rest. False once a client
+    // that is not reading has more than PIPE_OUTBUF_LIMIT waiting.
+    static bool flush_out(int epoll_fd, int fd, Owned& conn) {
+        if (!conn.out.empty()) {
+            ssize_t sent = send(fd, conn.out.data(), conn.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent > 0) conn.out.erase(0, sent);
+            else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) conn.out.clear();  // reads see the error
+        }
+        bool want_write = !conn.out.empty();
+        if (want_write != conn.want_write) {
+            epoll_event ev{};
+            ev.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            conn.want_write = want_write;
+        }
+        return conn.out.size() <= PIPE_OUTBUF_LIMIT;
+    }
+
+    static void drop(IoThread* io, std::unordered_map<int, Owned>& owned, int fd, std::vector<PipelineItem>& backlog) {
+        epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        owned.erase(fd);
+        PipelineItem item{};
+        item.fd = fd;
+        item.kind = PIPE_CLOSED;
+        backlog.push_back(item);
+    }
+
+    static bool watch(int epoll_fd, int fd) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    // The I/O thread always drains its inbox, so this only spins while it is mid-batch.
+    void post(size_t thread, const IoMessage& message) {
+        IoThread& io = *io_[thread];
+        while (!io.inbox.push(message)) {
+            uint64_t one = 1;
+            if (write(io.event_fd, &one, sizeof(one)) < 0) {}
+            std::this_thread::yield();
+        }
+        io.posted = true;
+    }
+
+    void run(IoThread* io) {
+        std::unordered_map<int, Owned> owned;
+        std::vector<PipelineItem> backlog;
+        std::vector<ParsedCommand> cmds;
+        epoll_event events[64];
+        char chunk[16384];
+
+        while (!stop_.load(std::memory_order_acquire)) {
+            int ready = epoll_wait(io->epoll_fd, events, 64, backlog.empty() ? -1 : 1);
+            IoMessage message;
+            while (io->inbox.pop(message)) {
+                std::unique_ptr<char[]> text(message.text);
+                if (message.kind == IO_ADOPT) {
+                    owned[message.fd] = Owned();
+                    watch(io->epoll_fd, message.fd);
+                    continue;
+                }
+                auto it = owned.find(message.fd);
+                if (it == owned.end()) continue;  // replies for a closed fd are dropped
+                if (message.kind == IO_ACK) {
+                    char ack[24];
+                    int len = snprintf(ack, sizeof(ack), "ACK %u\n", message.seq);
+                    it->second.out.append(ack, len);
+                } else {
+                    it->second.out.append(text.get(), message.seq);
+                }
+                if (!flush_out(io->epoll_fd, message.fd, it->second)) {
+                    fprintf(stderr, "[PIPE] FD=%d is not reading its replies; closing\n", message.fd);
+                    drop(io, owned, message.fd, backlog);
+                }
+            }
+            if (!publish(backlog)) continue;
+
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == io->event_fd) {
+                    uint64_t value;
+                    while (read(fd, &value, sizeof(value)) > 0) {}
+                    continue;
+                }
+                auto it = owned.find(fd);
+                if (it == owned.end()) continue;
+                if (events[i].events & EPOLLOUT) flush_out(io->epoll_fd, fd, it->second);
+                ssize_t len = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+                if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+                bool closing = len <= 0;
+                std::string& buf = it->second.in;
+                if (!closing) buf.append(chunk, len);
+                parse_into(fd, buf, closing, cmds, backlog);
+                if (!closing && buf.size() > PIPE_PENDING_LIMIT) {
+                    fprintf(stderr, "[PIPE] FD=%d sent a line over %zu bytes; closing\n", fd, PIPE_PENDING_LIMIT);
+                    closing = true;
+                }
+                if (closing) drop(io, owned, fd, backlog);
+            }
+            publish(backlog);
+        }
+    }
+
+    static void parse_into(int fd, std::string& buf, bool final, std::vector<ParsedCommand>& cmds,
+                           std::vector<PipelineItem>& backlog) {
+        cmds.resize(buf.size() / 2 + 1);
+        size_t consumed = 0;
+        size_t n = parse_command_batch(buf.data(), buf.size(), cmds.data(), cmds.size(), final, &consumed);
+        for (size_t i = 0; i < n; ++i) {
+            const ParsedCommand& cmd = cmds[i];
+            PipelineItem item{};
+            item.fd = fd;
+            if (cmd.op == OP_ADD && cmd.id >= 0) {
+                item.kind = PIPE_ADD;
+                item.id = cmd.id;
+                item.count = cmd.count;
+            } else {
+                item.kind = PIPE_TEXT;
+                item.text_len = (uint16_t)cmd.length;  // lines stay under PIPE_PENDING_LIMIT + one chunk
+                if (cmd.length <= PIPE_TEXT_BYTES) {
+                    std::memcpy(item.text, buf.data() + cmd.offset, cmd.length);
+                } else {
+                    char* copy = new char[cmd.length];
+                    std::memcpy(copy, buf.data() + cmd.offset, cmd.length);
+                    std::memcpy(item.text, &copy, sizeof(copy));
+                }
+            }
+            backlog.push_back(item);
+        }
+        buf.erase(0, consumed);
+    }
+
+    // Pushes the backlog in order; false if the ring filled up first.
+    bool publish(std::vector<PipelineItem>& backlog) {
+        size_t pushed = 0;
+        while (pushed < backlog.size() && ring_->push(backlog[pushed])) ++pushed;
+        if (pushed > 0) {
+            backlog.erase(backlog.begin(), backlog.begin() + pushed);
+            uint64_t one = 1;
+            if (write(wake_fd_, &one, sizeof(one)) < 0) {}
+        }
+        return backlog.empty();
+    }
+
+    std::unique_ptr<MpscRing<PipelineItem>> ring_;
+    std::vector<std::unique_ptr<IoThread>> io_;
+    size_t next_thread_ = 0;
+    int wake_fd_ = -1;
+    std::atomic<bool> stop_{false};
+};
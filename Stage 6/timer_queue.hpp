@@ -0,0 +1,51 @@
+// File: timer_queue.hpp
+// Description: Min-heap of millisecond deadlines that drives the event loop's epoll timeout.
+//              Timers are never removed early: the owner keeps a token and ignores a timer
+//              whose token no longer refers to anything live when it fires.
+
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+struct TimerEntry {
+    int64_t deadline_ms;
+    uint64_t token;
+    uint8_t kind;
+};
+
+class TimerQueue {
+public:
+    void schedule(int64_t deadline_ms, uint8_t kind, uint64_t token) {
+        heap_.push(TimerEntry{deadline_ms, token, kind});
+    }
+
+    bool empty() const { return heap_.empty(); }
+    size_t size() const { return heap_.size(); }
+
+    // Timeout for epoll_wait: -1 when nothing is scheduled, 0 when something is already due.
+    int timeout_ms(int64_t now) const {
+        if (heap_.empty()) return -1;
+        int64_t wait = heap_.top().deadline_ms - now;
+        if (wait <= 0) return 0;
+        return wait > INT_MAX ? INT_MAX : (int)wait;
+    }
+
+    // Pops and fires every timer due at now, earliest first.
+    template <typename Fire>
+    void run_expired(int64_t now, Fire&& fire) {
+        while (!heap_.empty() && heap_.top().deadline_ms <= now) {
+            TimerEntry entry = heap_.top();
+            heap_.pop();
+            fire(entry);
+        }
+    }
+
+private:
+    struct Later {
+        bool operator()(const TimerEntry& a, const TimerEntry& b) const { return a.deadline_ms > b.deadline_ms; }
+    };
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>, Later> heap_;
+};
@@ -0,0 +1,299 @@
+// File: trace_replay.cpp
+// Description: Replays a drinks_bar --trace capture against a bar, at the recorded pace,
+//              scaled by --speed, or as fast as possible with --max.
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "command_trace.hpp"
+#include "shm_ring.hpp"
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <TRACE_FILE> [--speed N | --max] [-h host] [-T tcp_port] [-U udp_port]"
+              << " [-s stream_path] [-d dgram_path] [-m shm_name]"
+              << " [--seqpacket-path path]\n";
+    std::cerr << "  Each traced client gets its own socket; transports without a target are skipped.\n";
+}
+
+struct Target {
+    std::string host = "127.0.0.1";
+    int tcp_port = -1;
+    int udp_port = -1;
+    std::string stream_path;
+    std::string dgram_path;
+    std::string seqpacket_path;
+    std::string shm_name;
+};
+
+struct ReplaySocket {
+    int fd = -1;
+    bool datagram = false;   // one message per command (UDP, UDS datagram, SEQPACKET)
+    std::string bound_path;  // UDS datagram clients bind a path so the bar can reply
+    std::unique_ptr<ShmClient> shm;  // shared-memory clients claim a channel instead
+};
+
+bool make_inet(const std::string& host, int port, sockaddr_in& addr) {
+    hostent* server = gethostbyname(host.c_str());
+    if (!server) return false;
+    addr = sockaddr_in{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    std::memcpy(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    return true;
+}
+
+sockaddr_un make_unix(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+// Opens and connects the socket standing in for one traced client. Datagram sockets are
+// connected too, so send() works for every transport.
+bool open_replay_socket(const Target& target, uint8_t transport, size_t index, ReplaySocket& out) {
+    if (transport == TRACE_SHM) {
+        if (target.shm_name.empty()) return false;
+        out.shm.reset(new ShmClient);
+        if (out.shm->attach(target.shm_name)) return true;
+        out.shm.reset();
+        return false;
+    }
+    sockaddr_in in_addr{};
+    sockaddr_un un_addr{};
+    const sockaddr* addr = nullptr;
+    socklen_t addr_len = 0;
+    int domain = AF_INET, type = SOCK_STREAM;
+
+    switch (transport) {
+        case TRACE_TCP:
+        case TRACE_UDP: {
+            int port = transport == TRACE_TCP ? target.tcp_port : target.udp_port;
+            if (port < 0 || !make_inet(target.host, port, in_addr)) return false;
+            addr = (const sockaddr*)&in_addr;
+            addr_len = sizeof(in_addr);
+            type = transport == TRACE_TCP ? SOCK_STREAM : SOCK_DGRAM;
+            break;
+        }
+        case TRACE_UDS_STREAM:
+        case TRACE_UDS_DGRAM:
+        case TRACE_SEQPACKET: {
+            const std::string& path = transport == TRACE_UDS_STREAM ? target.stream_path
+                                      : transport == TRACE_UDS_DGRAM ? target.dgram_path
+                                                                     : target.seqpacket_path;
+            if (path.empty()) return false;
+            un_addr = make_unix(path);
+            addr = (const sockaddr*)&un_addr;
+            addr_len = sizeof(un_addr);
+            domain = AF_UNIX;
+            type = transport == TRACE_UDS_STREAM ? SOCK_STREAM : transport == TRACE_UDS_DGRAM ? SOCK_DGRAM : SOCK_SEQPACKET;
+            break;
+        }
+        default:
+            return false;
+    }
+
+    out.datagram = type != SOCK_STREAM;
+    out.fd = socket(domain, type | SOCK_CLOEXEC, 0);
+    if (out.fd < 0) {
+        perror("socket");
+        return false;
+    }
+    if (domain == AF_UNIX && type == SOCK_DGRAM) {
+        out.bound_path = "/tmp/trace_replay_" + std::to_string(getpid()) + "_" + std::to_string(index);
+        sockaddr_un self = make_unix(out.bound_path);
+        unlink(out.bound_path.c_str());
+        if (bind(out.fd, (sockaddr*)&self, sizeof(self)) < 0) {
+            perror("bind (UDS client)");
+            return false;
+        }
+    }
+    if (connect(out.fd, addr, addr_len) < 0) {
+        perror("connect");
+        return false;
+    }
+    if (transport == TRACE_TCP) {
+        int one = 1;
+        setsockopt(out.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    fcntl(out.fd, F_SETFL, fcntl(out.fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+bool send_all(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n > 0) {
+            off += n;
+        } else if (n < 0 && errno == EAGAIN) {
+            pollfd pfd{fd, POLLOUT, 0};
+            poll(&pfd, 1, 100);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Datagram, SEQPACKET and shared-memory replies are only counted; stream sockets may also carry ACK lines.
+uint64_t drain_replies(std::vector<ReplaySocket>& socks) {
+    uint64_t replies = 0;
+    char buffer[4096];
+    std::string reply;
+    for (ReplaySocket& s : socks) {
+        while (s.shm && s.shm->outstanding() > 0 && s.shm->receive(reply, false, 0)) ++replies;
+        if (s.fd < 0) continue;
+        while (true) {
+            ssize_t n = recv(s.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n <= 0) break;
+            if (s.datagram) ++replies;
+        }
+    }
+    return replies;
+}
+
+int main(int argc, char* argv[]) {
+    Target target;
+    double speed = 1.0;
+    bool max_speed = false;
+
+    static struct option long_options[] = {
+        {"speed", required_argument, nullptr, 'x'},
+        {"max", no_argument, nullptr, 'M'},
+        {"seqpacket-path", required_argument, nullptr, 'P'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h:T:U:s:d:m:", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'h': target.host = optarg; break;
+            case 'T': target.tcp_port = std::atoi(optarg); break;
+            case 'U': target.udp_port = std::atoi(optarg); break;
+            case 's': target.stream_path = optarg; break;
+            case 'd': target.dgram_path = optarg; break;
+            case 'm': target.shm_name = optarg; break;
+            case 'P': target.seqpacket_path = optarg; break;
+            case 'x': speed = std::atof(optarg); break;
+            case 'M': max_speed = true; break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || speed <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[optind], "rb");
+    if (!in) {
+        perror("open (trace file)");
+        return 1;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || std::memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+        header.record_size != sizeof(TraceRecord)) {
+        std::cerr << "Error: " << argv[optind] << " is not a drinks_bar trace.\n";
+        fclose(in);
+        return 1;
+    }
+
+    std::map<std::pair<uint8_t, uint32_t>, size_t> socket_of;
+    std::vector<ReplaySocket> socks;
+    uint64_t sent = 0, skipped = 0, replies = 0;
+    uint64_t start_ns = trace_clock_ns();
+    uint64_t last_ts = 0;
+    TraceRecord rec;
+    std::vector<char> text;
+
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        text.resize(rec.text_len);
+        if (rec.text_len && fread(text.data(), rec.text_len, 1, in) != 1) break;
+        last_ts = rec.timestamp_ns;
+        if (rec.transport == TRACE_CONSOLE) {
+            ++skipped;
+            continue;
+        }
+
+        auto key = std::make_pair(rec.transport, rec.client);
+        auto it = socket_of.find(key);
+        if (it == socket_of.end()) {
+            ReplaySocket s;
+            if (!open_replay_socket(target, rec.transport, socks.size(), s) && s.fd >= 0) {
+                close(s.fd);
+                s.fd = -1;
+            }
+            it = socket_of.emplace(key, socks.size()).first;
+            socks.push_back(std::move(s));
+        }
+        ReplaySocket& s = socks[it->second];
+        if (s.fd < 0 && !s.shm) {
+            ++skipped;
+            continue;
+        }
+
+        if (!max_speed) {
+            uint64_t due = start_ns + (uint64_t)(rec.timestamp_ns / speed);
+            uint64_t now;
+            while ((now = trace_clock_ns()) < due) {
+                uint64_t wait_ns = due - now;
+                if (wait_ns > 1000000) {
+                    replies += drain_replies(socks);
+                    wait_ns = 1000000;
+                }
+                timespec nap{0, (long)wait_ns};
+                nanosleep(&nap, nullptr);
+            }
+        }
+
+        std::string line = trace_command_text(rec, text.data());
+        bool ok;
+        if (s.shm) {
+            std::string reply;
+            // A channel holds SHM_RING_SLOTS requests ahead of their replies.
+            while (s.shm->outstanding() == SHM_RING_SLOTS && s.shm->receive(reply, false, 1000)) ++replies;
+            ok = s.shm->send(line);
+        } else {
+            ok = s.datagram ? send(s.fd, line.data(), line.size(), 0) >= 0 : send_all(s.fd, line + "\n");
+        }
+        if (ok) ++sent;
+        else ++skipped;
+        if ((sent & 255) == 0) replies += drain_replies(socks);
+    }
+    fclose(in);
+
+    double seconds = (trace_clock_ns() - start_ns) / 1e9;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    replies += drain_replies(socks);
+    for (ReplaySocket& s : socks) {
+        std::string reply;
+        while (s.shm && s.shm->outstanding() > 0 && s.shm->receive(reply, false, 1000)) ++replies;
+        if (s.fd >= 0) close(s.fd);
+        if (!s.bound_path.empty()) unlink(s.bound_path.c_str());
+    }
+
+    printf("Replayed %llu commands from %zu clients in %.3f s (%.0f cmds/s; trace spanned %.3f s), "
+           "%llu datagram/shm replies, %llu skipped\n",
+           (unsigned long long)sent, socks.size(), seconds, seconds > 0 ? sent / seconds : 0.0, last_ts / 1e9,
+           (unsigned long long)replies, (unsigned long long)skipped);
+    return 0;
+}